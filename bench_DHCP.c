@@ -0,0 +1,501 @@
+// Microbenchmarks de las funciones calientes del servidor. Incluye el servidor entero,
+// cuyo main pasa a llamarse servidor_main, para llamar directamente a sus funciones:
+//   gcc -O2 -pthread bench_DHCP.c -o bench
+// Cada pool se recorre en rondas (la primera, de calentamiento, no cuenta) hasta sumar
+// un mínimo de rondas y de tiempo. Cada resultado es una línea JSON en la salida
+// estándar con la mediana y el mínimo de ns/op entre rondas, millones de operaciones
+// por segundo según la mediana y reservas de memoria por operación.
+#define main servidor_main
+#include "servidor_DHCP.c"
+#undef main
+
+#define BENCH_MAC_BASE 0x020000000000ULL  // MACs administradas localmente
+#define BENCH_RESERVED_MAC 0x020100000000ULL  // MACs de las reservas
+#define BENCH_CHECK_CALLS 10000           // Llamadas a check_ip_leases por ronda
+#define BENCH_OPTIONS_CALLS 100000        // Llamadas a build_dhcp_options por hilo y ronda
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_STEPS 16                // Mediciones con nombre por ronda
+#define BENCH_MAX_ROUNDS 1000
+#define BENCH_MIN_ROUNDS 5                // Por defecto; se cambia con -r
+#define BENCH_MIN_NS 1000000000ULL        // Tiempo medido mínimo por pool
+
+// Cuenta de reservas de memoria: el programa sustituye a las funciones de glibc y
+// delega en ellas
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+static _Atomic uint64_t bench_allocs;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+// Estado de una medición: cada hilo trabaja sobre su tramo de MACs y de IPs
+typedef struct bench_run {
+    const char *name;
+    void (*fn)(struct bench_run *run, int id, long first, long count);
+    pool_config *cfg;
+    uint32_t *ips;               // IP asignada a cada MAC (orden de host)
+    long ops_per_item;           // Operaciones que cuenta cada elemento del tramo
+    int sockfd;                  // Socket al que van las respuestas de handle_client
+    struct sockaddr_in sink;     // Dirección de ese socket
+    time_t horizon;              // Segundo hasta el que se avanzan las ruedas
+    long num_reserved;           // Reservas al final del rango, una por MAC desde BENCH_RESERVED_MAC
+    uint32_t range_last;         // Última IP del rango (orden de host)
+    pthread_barrier_t start;
+    int round;                   // Ronda en curso; la 0 es de calentamiento
+    int num_results;
+    struct bench_result {
+        const char *name;
+        int threads;
+        long ops;                // Operaciones de cada ronda
+        uint64_t allocs;         // Suma de todas las rondas contadas
+        uint64_t ns[BENCH_MAX_ROUNDS];
+    } results[BENCH_MAX_STEPS];
+} bench_run;
+
+typedef struct {
+    bench_run *run;
+    int id;
+    long first;
+    long count;
+    uint64_t t_start;            // Tomados por el propio hilo tras la barrera
+    uint64_t t_end;
+    pthread_t thread;
+} bench_thread;
+
+static inline uint64_t bench_mac(long k) {
+    return BENCH_MAC_BASE + k;
+}
+
+// Ofrece una IP a cada MAC del tramo
+static void bench_assign(bench_run *run, int id, long first, long count) {
+    (void)id;
+    dhcp_scope *scope = &run->cfg->scopes[0];
+    for (long k = first; k < first + count; k++) {
+        if (assign_ip_dynamic(run->cfg, scope, bench_mac(k), &run->ips[k]) != 0) {
+            fprintf(stderr, "assign_ip_dynamic: pool agotado en la MAC %ld\n", k);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void bench_release(bench_run *run, int id, long first, long count) {
+    (void)id;
+    for (long k = first; k < first + count; k++) {
+        release_ip_dynamic(run->cfg, bench_mac(k), run->ips[k]);
+    }
+}
+
+// Convierte en lease la oferta de cada MAC del tramo
+static void bench_commit(bench_run *run, int id, long first, long count) {
+    (void)id;
+    dhcp_scope *scope = &run->cfg->scopes[0];
+    for (long k = first; k < first + count; k++) {
+        request_ip(run->cfg, scope, bench_mac(k), run->ips[k]);
+    }
+}
+
+// DHCPLEASEQUERY por IP y por MAC sobre leases activos: solo lecturas del pool
+static void bench_query_ip(bench_run *run, int id, long first, long count) {
+    (void)id;
+    time_t now = time(NULL);
+    lease_info info;
+    for (long k = first; k < first + count; k++) {
+        uint32_t ip = run->ips[k];
+        int type = lease_query_ip(run->cfg, ip, now, &info);
+        if (type != DHCPLEASEACTIVE) {
+            fprintf(stderr, "leasequery_ip: la IP %u.%u.%u.%u de la MAC %ld devuelve %s\n", ip >> 24, (ip >> 16) & 255,
+                    (ip >> 8) & 255, ip & 255, k, dhcp_type_name(type));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void bench_query_mac(bench_run *run, int id, long first, long count) {
+    (void)id;
+    time_t now = time(NULL);
+    lease_info info;
+    for (long k = first; k < first + count; k++) {
+        int type = lease_query_mac(run->cfg, bench_mac(k), now, &info);
+        if (type != DHCPLEASEACTIVE) {
+            fprintf(stderr, "leasequery_mac: la MAC %ld devuelve %s\n", k, dhcp_type_name(type));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// DHCPLEASEQUERY por IP y por MAC de equipos con reserva, que no tienen estado en el pool
+static void bench_query_reserved(bench_run *run, int id, long first, long count) {
+    (void)id;
+    time_t now = time(NULL);
+    lease_info info;
+    for (long k = first; k < first + count; k++) {
+        long r = k % run->num_reserved;
+        uint64_t mac = BENCH_RESERVED_MAC + r;
+        uint32_t ip = run->range_last - r;
+        int type = lease_query_ip(run->cfg, ip, now, &info);
+        if (type != DHCPLEASEACTIVE || info.mac != mac) {
+            fprintf(stderr, "leasequery_reserved: la IP %u.%u.%u.%u reservada para la MAC %ld devuelve %s\n", ip >> 24,
+                    (ip >> 16) & 255, (ip >> 8) & 255, ip & 255, r, dhcp_type_name(type));
+            exit(EXIT_FAILURE);
+        }
+        type = lease_query_mac(run->cfg, mac, now, &info);
+        if (type != DHCPLEASEACTIVE || info.ip != ip) {
+            fprintf(stderr, "leasequery_reserved: la MAC %ld con reserva devuelve %s\n", r, dhcp_type_name(type));
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Vencimiento de las ofertas: cada hilo avanza las ruedas de sus particiones, como
+// check_ip_leases (un hilo) o shard_tick (modo fragmentado) al llegar su segundo
+static void bench_expire(bench_run *run, int id, long first, long count) {
+    (void)first;
+    (void)count;
+    for (int k = 0; k < run->cfg->num_shards; k++) {
+        if (run->cfg->shards[k].part == id) {
+            wheel_advance(&run->cfg->shards[k].timers, run->horizon);
+        }
+    }
+}
+
+static void bench_options(bench_run *run, int id, long first, long count) {
+    (void)id;
+    (void)first;
+    const option_template *tpl = &run->cfg->scopes[0].options;
+    dhcp_packet response;
+    size_t total = 0;
+
+    memset(&response, 0, sizeof(response));
+    for (long k = 0; k < count; k++) {
+        total += build_dhcp_options(&response, tpl, (k & 1) ? DHCPACK : DHCPOFFER, LEASE_TIME);
+    }
+    if (total == 0) {
+        // Evita además que el compilador descarte el bucle
+        fprintf(stderr, "build_dhcp_options: bloque de opciones vacío\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Ciclo completo de cada MAC por handle_client: DHCPDISCOVER, DHCPREQUEST de la IP
+// ofrecida y DHCPRELEASE. Las respuestas salen en lotes hacia un socket sumidero
+static void bench_dispatch(bench_run *run, int id, long first, long count) {
+    (void)id;
+    pool_config *cfg = run->cfg;
+    dhcp_scope *scope = &cfg->scopes[0];
+    client_data data;
+    size_t pos;
+
+    memset(&data, 0, sizeof(data));
+    data.sockfd = run->sockfd;
+    data.client_addr = run->sink;
+    for (long k = first; k < first + count; k++) {
+        uint64_t mac = bench_mac(k);
+        uint8_t type = DHCPDISCOVER;
+
+        dhcp_init_packet(&data.msg, BOOTREQUEST, (uint32_t)k, mac);
+        pos = 0;
+        dhcp_put_option(&data.msg, &pos, OPT_MESSAGE_TYPE, 1, &type);
+        data.len = dhcp_finish(&data.msg, pos);
+        handle_client(cfg, &data);
+
+        long i = mac_index_lookup(&cfg->lease_index, mac, scope->first, scope->first + scope->count);
+        if (i < 0) {
+            fprintf(stderr, "handle_client: la MAC %ld no recibió oferta\n", k);
+            exit(EXIT_FAILURE);
+        }
+        uint32_t ip = htonl(cfg->ip_pool[i].ip_addr);
+        type = DHCPREQUEST;
+        pos = 0;
+        dhcp_put_option(&data.msg, &pos, OPT_MESSAGE_TYPE, 1, &type);
+        dhcp_put_option(&data.msg, &pos, OPT_REQUESTED_IP, 4, &ip);
+        dhcp_put_option(&data.msg, &pos, OPT_SERVER_ID, 4, &server_id);
+        data.len = dhcp_finish(&data.msg, pos);
+        handle_client(cfg, &data);
+
+        type = DHCPRELEASE;
+        data.msg.ciaddr = ip;
+        pos = 0;
+        dhcp_put_option(&data.msg, &pos, OPT_MESSAGE_TYPE, 1, &type);
+        data.len = dhcp_finish(&data.msg, pos);
+        handle_client(cfg, &data);
+    }
+    if (tx_batch->count > 0) {
+        flush_replies(tx_batch);
+    }
+}
+
+static void *bench_thread_main(void *arg) {
+    bench_thread *t = (bench_thread *)arg;
+
+    // Lo que cada hilo reserva una sola vez queda fuera de la medición
+    home_shard = t->id;
+    metrics();
+    if (tx_batch == NULL) {
+        tx_batch = reply_batch_create();
+    }
+    pthread_barrier_wait(&t->run->start);
+    t->t_start = monotonic_ns();
+    t->run->fn(t->run, t->id, t->first, t->count);
+    t->t_end = monotonic_ns();
+    free(tx_batch);
+    tx_batch = NULL;
+    return NULL;
+}
+
+static int bench_min_rounds = BENCH_MIN_ROUNDS;
+
+// Guarda el tiempo de una medición en la ronda en curso; la de calentamiento se descarta
+static void bench_record(bench_run *run, const char *name, int threads, long ops, uint64_t ns, uint64_t allocs) {
+    if (name == NULL || run->round == 0) {
+        return;
+    }
+    int r = 0;
+    while (r < run->num_results && strcmp(run->results[r].name, name) != 0) {
+        r++;
+    }
+    if (r == run->num_results) {
+        run->results[r] = (struct bench_result){ .name = name, .threads = threads, .ops = ops };
+        run->num_results++;
+    }
+    run->results[r].ns[run->round - 1] = ns;
+    run->results[r].allocs += allocs;
+}
+
+// Una línea por medición con la mediana y el mínimo de ns/op de las rondas contadas
+static void bench_report(bench_run *run, int prefix, int rounds) {
+    uint64_t sorted[BENCH_MAX_ROUNDS];
+
+    for (int r = 0; r < run->num_results; r++) {
+        struct bench_result *res = &run->results[r];
+        memcpy(sorted, res->ns, rounds * sizeof(uint64_t));
+        qsort(sorted, rounds, sizeof(uint64_t), compare_u64);
+        double median = (sorted[(rounds - 1) / 2] + sorted[rounds / 2]) / 2.0;
+        printf("{\"bench\":\"%s\",\"prefix\":%d,\"pool_size\":%d,\"threads\":%d,\"ops\":%ld,\"rounds\":%d,"
+               "\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,\"mops\":%.3f,\"allocs_per_op\":%.4f}\n",
+               res->name, prefix, run->cfg->pool_size, res->threads, res->ops, rounds,
+               median * res->threads / res->ops, (double)sorted[0] * res->threads / res->ops,
+               median > 0 ? res->ops * 1e3 / median : 0.0, (double)res->allocs / ((double)res->ops * rounds));
+    }
+    fflush(stdout);
+}
+
+// Reparte items elementos entre los hilos y mide el tiempo de pared desde que arranca
+// el primero hasta que termina el último
+static void bench_measure(bench_run *run, int threads, long items) {
+    bench_thread workers[BENCH_MAX_THREADS];
+    long per = items / threads;
+
+    pthread_barrier_init(&run->start, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        workers[t] = (bench_thread){ run, t, t * per, per, 0, 0, 0 };
+        if (pthread_create(&workers[t].thread, NULL, bench_thread_main, &workers[t]) != 0) {
+            perror("Error al crear el hilo de medición");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_barrier_wait(&run->start);
+    uint64_t allocs = atomic_load(&bench_allocs);
+    uint64_t t_start = UINT64_MAX, t_end = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        if (workers[t].t_start < t_start) {
+            t_start = workers[t].t_start;
+        }
+        if (workers[t].t_end > t_end) {
+            t_end = workers[t].t_end;
+        }
+    }
+    allocs = atomic_load(&bench_allocs) - allocs;
+    pthread_barrier_destroy(&run->start);
+    bench_record(run, run->name, threads, per * threads * run->ops_per_item, t_end - t_start, allocs);
+}
+
+static void bench_step(bench_run *run, const char *name, void (*fn)(bench_run *, int, long, long), long ops_per_item,
+                       int threads, long items) {
+    run->name = name;
+    run->fn = fn;
+    run->ops_per_item = ops_per_item;
+    bench_measure(run, threads, items);
+}
+
+// Una ronda: cada medición parte del estado que deja la anterior y el pool queda
+// vacío al final, listo para la siguiente
+static void bench_round(bench_run *run, int threads, long items) {
+    bench_step(run, "assign_ip_dynamic", bench_assign, 1, threads, items);
+    bench_step(run, "release_ip_dynamic", bench_release, 1, threads, items);
+
+    // Rueda sin vencimientos: el coste fijo de cada tic de check_ip_leases
+    bench_step(run, NULL, bench_assign, 1, threads, items);
+    uint64_t allocs = atomic_load(&bench_allocs);
+    uint64_t t0 = monotonic_ns();
+    for (int k = 0; k < BENCH_CHECK_CALLS; k++) {
+        check_ip_leases();
+    }
+    bench_record(run, "check_ip_leases", 1, BENCH_CHECK_CALLS, monotonic_ns() - t0,
+                 atomic_load(&bench_allocs) - allocs);
+
+    // Todas las ofertas vencen a la vez. Las ruedas ya pasaron el horizonte de la ronda
+    // anterior, así que cada ronda lo lleva más lejos
+    time_t now = time(NULL);
+    run->horizon = (run->horizon > now ? run->horizon : now) + offer_time + 1;
+    bench_step(run, "expire_leases", bench_expire, 1, threads, items);
+
+    // Consultas con el 90% del pool en lease, medidas aparte de la asignación
+    bench_step(run, NULL, bench_assign, 1, threads, items);
+    bench_step(run, NULL, bench_commit, 1, threads, items);
+    bench_step(run, "leasequery_ip", bench_query_ip, 1, threads, items);
+    bench_step(run, "leasequery_mac", bench_query_mac, 1, threads, items);
+    bench_step(run, "leasequery_reserved", bench_query_reserved, 2, threads, items);
+    bench_step(run, NULL, bench_release, 1, threads, items);
+
+    bench_step(run, "build_dhcp_options", bench_options, 1, threads, (long)BENCH_OPTIONS_CALLS * threads);
+    bench_step(run, "handle_client", bench_dispatch, 3, threads, items);
+}
+
+// Todas las mediciones de un pool /prefix con el número de hilos indicado
+static void bench_pool(int prefix, int threads) {
+    char first[INET_ADDRSTRLEN], last[INET_ADDRSTRLEN];
+    struct in_addr addr;
+    uint32_t base = 0x0a000000;  // 10.0.0.0/prefix
+
+    addr.s_addr = htonl(base + 1);
+    inet_ntop(AF_INET, &addr, first, sizeof(first));
+    addr.s_addr = htonl(base + (1u << (32 - prefix)) - 2);
+    inet_ntop(AF_INET, &addr, last, sizeof(last));
+
+    num_parts = threads;  // Una partición por hilo, como en el modo fragmentado
+    static bench_run run;
+    memset(&run, 0, sizeof(run));
+
+    // Un 5% del pool, al final del rango, queda reservado para equipos fijos
+    char reserved_path[] = "/tmp/bench_DHCP_XXXXXX";
+    int fd = mkstemp(reserved_path);
+    FILE *reserved = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (reserved == NULL) {
+        perror("No se pudo crear el fichero de reservas");
+        exit(EXIT_FAILURE);
+    }
+    run.range_last = base + (1u << (32 - prefix)) - 2;
+    run.num_reserved = ((1L << (32 - prefix)) - 2) / 20;
+    for (long r = 0; r < run.num_reserved; r++) {
+        char mac[18], ip[INET_ADDRSTRLEN];
+        dhcp_format_mac(BENCH_RESERVED_MAC + r, mac);
+        addr.s_addr = htonl(run.range_last - r);
+        inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+        fprintf(reserved, "%s %s\n", mac, ip);
+    }
+    fclose(reserved);
+    run.cfg = build_config(NULL, first, last, reserved_path);
+    unlink(reserved_path);
+    if (run.cfg == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&active_config, run.cfg);
+    run.sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    run.sink.sin_family = AF_INET;
+    run.sink.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sink_len = sizeof(run.sink);
+    if (run.sockfd < 0 || bind(run.sockfd, (struct sockaddr *)&run.sink, sizeof(run.sink)) < 0 ||
+        getsockname(run.sockfd, (struct sockaddr *)&run.sink, &sink_len) < 0) {
+        perror("No se pudo crear el socket sumidero");
+        exit(EXIT_FAILURE);
+    }
+
+    // Se llena el 90% del pool para no medir el caso de pool agotado
+    long items = run.cfg->pool_size * 9L / 10 / threads * threads;
+    run.ips = malloc(items * sizeof(uint32_t));
+    if (run.ips == NULL) {
+        perror("Error al asignar memoria para la medición");
+        exit(EXIT_FAILURE);
+    }
+
+    // Ronda de calentamiento y después rondas hasta el mínimo de rondas y de tiempo
+    uint64_t measured = 0;
+    for (run.round = 0; run.round <= BENCH_MAX_ROUNDS; run.round++) {
+        uint64_t t0 = monotonic_ns();
+        bench_round(&run, threads, items);
+        if (run.round > 0) {
+            measured += monotonic_ns() - t0;
+            if (run.round >= bench_min_rounds && measured >= BENCH_MIN_NS) {
+                break;
+            }
+        }
+    }
+    bench_report(&run, prefix, run.round > BENCH_MAX_ROUNDS ? BENCH_MAX_ROUNDS : run.round);
+
+    close(run.sockfd);
+    free(run.ips);
+    free_config(run.cfg);
+}
+
+// Lista de enteros separados por comas
+static int parse_list(const char *arg, int *values, int max, int lo, int hi) {
+    int n = 0;
+    char *copy = strdup(arg), *save, *token;
+    for (token = strtok_r(copy, ",", &save); token != NULL && n < max; token = strtok_r(NULL, ",", &save)) {
+        values[n] = atoi(token);
+        if (values[n] < lo || values[n] > hi) {
+            n = -1;
+            break;
+        }
+        n++;
+    }
+    free(copy);
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    int prefixes[16] = { 24, 20, 16, 12 }, num_prefixes = 4;
+    int threads[16] = { 1, 2, 4 }, num_threads = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:t:r:")) != -1) {
+        switch (opt) {
+            case 'p':
+                num_prefixes = parse_list(optarg, prefixes, 16, 12, 24);
+                break;
+            case 't':
+                num_threads = parse_list(optarg, threads, 16, 1, BENCH_MAX_THREADS);
+                break;
+            case 'r':
+                bench_min_rounds = atoi(optarg);
+                break;
+            default:
+                num_prefixes = -1;
+        }
+        if (num_prefixes <= 0 || num_threads <= 0 || bench_min_rounds < 1 || bench_min_rounds > BENCH_MAX_ROUNDS) {
+            fprintf(stderr, "Uso: %s [-p prefijos entre 12 y 24, p. ej. 24,20,16,12] [-t hilos, p. ej. 1,2,4] "
+                    "[-r rondas mínimas, %d por defecto]\n", argv[0], BENCH_MIN_ROUNDS);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Sin registro, diario, estadísticas ni límites: solo las funciones medidas
+    log_level = LOG_ERROR;
+    inet_pton(AF_INET, SERVER_IDENTIFIER, &server_id);
+    for (int p = 0; p < num_prefixes; p++) {
+        for (int t = 0; t < num_threads; t++) {
+            bench_pool(prefixes[p], threads[t]);
+        }
+    }
+    return 0;
+}
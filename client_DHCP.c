@@ -1,3 +1,4 @@
+#define _GNU_SOURCE         // sendmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,38 +8,133 @@
 #include <netinet/in.h>
 #include <time.h>
 #include <signal.h>  // Para manejar señales como Ctrl + C
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "codec_DHCP.h"
 
 #define SERVER_PORT 1067         // Puerto donde escucha el servidor DHCP
 #define CLIENT_PORT 68           // Puerto donde escucha el cliente DHCP
 #define SERVER_IP "127.0.0.1"    // IP del servidor (usando localhost para pruebas)
 #define MAX_RENEWALS 4           // Máximo número de renovaciones
+#define CLIENT_MAC 0x001122334455ULL // Simulación de la MAC (00:11:22:33:44:55)
 
-// Estructura para un mensaje DHCP (simplificada para el ejemplo)
-typedef struct {
-    int message_type;         // Tipo de mensaje (1 = DHCPDISCOVER, 3 = DHCPREQUEST, 5 = DHCPRELEASE)
-    char client_mac[18];      // Dirección MAC del cliente (formato: XX:XX:XX:XX:XX:XX)
-    char requested_ip[16];    // Dirección IP solicitada por el cliente
-    uint8_t options[312];     // Campo para recibir las opciones DHCP
-} dhcp_message;
+// Retransmisión (RFC 2131, 4.1 y 4.4.5)
+#define RETRY_BASE_NS 4000000000ULL     // Primera espera antes de retransmitir
+#define RETRY_MAX_NS 64000000000ULL     // La espera se duplica hasta este máximo
+#define RETRY_JITTER_NS 1000000000ULL   // Desviación aleatoria de ±1 s
+#define RENEW_MIN_WAIT_NS 4000000000ULL // Espera mínima entre retransmisiones al renovar
+#define ACQUIRE_DEADLINE_S 64           // Plazo por defecto para obtener una IP
+#define REQUEST_DEADLINE_S 16           // Plazo por defecto para confirmar una oferta
 
 uint32_t lease_time = 0;       // Variable para almacenar el lease time recibido
+uint32_t renewal_time = 0;     // T1 enviado por el servidor (opción 58, 0 = ausente)
+uint32_t rebinding_time = 0;   // T2 enviado por el servidor (opción 59, 0 = ausente)
 time_t lease_start_time;       // Marca de tiempo cuando se recibe la IP
+uint64_t lease_start_ns;       // La misma marca en el reloj monótono
 
 int sockfd;                    // Descriptor del socket global para que se pueda usar en la señal
 char assigned_ip[16];          // Para almacenar la IP asignada globalmente
+uint32_t assigned_addr;        // IP asignada en orden de red
+uint32_t server_id;            // Identificador del servidor que concedió la IP (opción 54)
 struct sockaddr_in server_addr; // Estructura para la dirección del servidor
 socklen_t addr_len = sizeof(server_addr); // Tamaño de la estructura del servidor
 
+// Construye una solicitud del cliente con su tipo de mensaje; devuelve la posición de opciones
+size_t build_request(dhcp_packet *msg, uint64_t mac, uint32_t xid, uint8_t type) {
+    size_t pos = 0;
+    dhcp_init_packet(msg, BOOTREQUEST, xid, mac);
+    dhcp_put_option(msg, &pos, OPT_MESSAGE_TYPE, 1, &type);
+    return pos;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Espera antes de la retransmisión número 'attempt': 4, 8, 16... hasta 64 s, ±1 s al azar
+uint64_t retry_delay(unsigned attempt) {
+    uint64_t delay = attempt < 4 ? RETRY_BASE_NS << attempt : RETRY_MAX_NS;
+    return delay - RETRY_JITTER_NS + (uint64_t)random() % (2 * RETRY_JITTER_NS + 1);
+}
+
+// Espera una respuesta del servidor a la transacción xid hasta deadline_ns; devuelve su tipo o -1
+int receive_reply(int sockfd, uint32_t xid, dhcp_packet *response, dhcp_view *view, uint64_t deadline_ns) {
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+
+    while (1) {
+        uint64_t now = now_ns();
+        if (now >= deadline_ns) {
+            return -1;
+        }
+        int ready = poll(&pfd, 1, (deadline_ns - now + 999999) / 1000000);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t len = recvfrom(sockfd, response, sizeof(*response), 0, NULL, NULL);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Se ignoran mensajes mal formados o de otras transacciones
+        if (dhcp_parse(response, len, view) == 0 && response->op == BOOTREPLY && response->xid == xid) {
+            return dhcp_message_type(view);
+        }
+    }
+}
+
+// Envía msg y lo retransmite hasta recibir una respuesta a su xid o llegar a deadline_ns.
+// Con 'halving' se espera la mitad del tiempo que queda (renovación y reenlace); si no,
+// la espera crece exponencialmente. Devuelve el tipo de la respuesta o -1
+int exchange(dhcp_packet *msg, size_t pos, const char *what, uint64_t deadline_ns, int halving,
+             dhcp_packet *response, dhcp_view *view) {
+    size_t len = dhcp_finish(msg, pos);
+    uint64_t start = now_ns();
+
+    for (unsigned attempt = 0; ; attempt++) {
+        uint64_t now = now_ns();
+        if (now >= deadline_ns) {
+            return -1;
+        }
+        if (attempt > 0) {
+            printf("Sin respuesta; retransmitiendo %s (intento %u)\n", what, attempt + 1);
+        }
+        msg->secs = htons((now - start) / 1000000000ULL);
+        if (sendto(sockfd, msg, len, 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
+            perror("Error al enviar el mensaje");
+        }
+
+        uint64_t wait = halving ? (deadline_ns - now) / 2 : retry_delay(attempt);
+        if (halving && wait < RENEW_MIN_WAIT_NS) {
+            wait = deadline_ns - now;
+        }
+        uint64_t until = now + wait < deadline_ns ? now + wait : deadline_ns;
+        int type = receive_reply(sockfd, msg->xid, response, view, until);
+        if (type >= 0) {
+            return type;
+        }
+    }
+}
+
 // Función para enviar DHCPRELEASE al servidor
 void send_dhcp_release() {
-    dhcp_message release_msg;
-    memset(&release_msg, 0, sizeof(release_msg));
-    release_msg.message_type = 5; // 5 = DHCPRELEASE
-    strcpy(release_msg.client_mac, "00:11:22:33:44:55"); // Simulación de la MAC
-    strcpy(release_msg.requested_ip, assigned_ip);       // IP asignada previamente
+    dhcp_packet release_msg;
+    size_t pos = build_request(&release_msg, CLIENT_MAC, random(), DHCPRELEASE);
+    release_msg.ciaddr = assigned_addr;                  // IP asignada previamente
+    dhcp_put_option(&release_msg, &pos, OPT_SERVER_ID, 4, &server_id);
+    size_t len = dhcp_finish(&release_msg, pos);
 
     printf("Enviando DHCPRELEASE para la IP %s...\n", assigned_ip);
-    if (sendto(sockfd, &release_msg, sizeof(release_msg), 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
+    if (sendto(sockfd, &release_msg, len, 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
         perror("Error al enviar DHCPRELEASE");
     } else {
         printf("DHCPRELEASE enviado para la IP %s\n", assigned_ip);
@@ -53,94 +149,91 @@ void signal_handler(int signum) {
 }
 
 // Función para imprimir las opciones recibidas del servidor
-void print_dhcp_options(dhcp_message *response) {
-    uint8_t *options = response->options;
-    int offset = 0;
-
-    while (options[offset] != 255) { // 255 es el fin de opciones
-        int option_code = options[offset++];
-        int option_length = options[offset++];
-
-        switch (option_code) {
-            case 53: // Tipo de mensaje DHCP
-                printf("Tipo de mensaje DHCP: ");
-                switch (options[offset]) {
-                    case 1:
-                        printf("DHCPDISCOVER\n");
-                        break;
-                    case 2:
-                        printf("DHCPOFFER\n");
-                        break;
-                    case 3:
-                        printf("DHCPREQUEST\n");
-                        break;
-                    case 4:
-                        printf("DHCPACK\n");
-                        break;
-                    case 5:
-                        printf("DHCPNAK\n");
-                        break;
-                    case 6:
-                        printf("DHCPRELEASE\n");
-                        break;
-                    case 7:
-                        printf("DHCPINFORM\n");
-                        break;
-                    default:
-                        printf("Desconocido (%d)\n", options[offset]);
-                        break;
-                }
-                break;
+void print_dhcp_options(const dhcp_view *view) {
+    uint32_t value;
 
-            case 51: // Tiempo de concesión (lease time)
-                printf("Tiempo de concesión: ");
-                memcpy(&lease_time, &options[offset], sizeof(lease_time));
-                lease_time = ntohl(lease_time); // Convertir de formato de red a formato local
-                printf("%u segundos\n", lease_time);
-                lease_start_time = time(NULL); // Guardar el momento en que se asigna la IP
-                break;
+    printf("Tipo de mensaje DHCP: ");
+    switch (dhcp_message_type(view)) {
+        case DHCPDISCOVER:
+        case DHCPOFFER:
+        case DHCPREQUEST:
+        case DHCPDECLINE:
+        case DHCPACK:
+        case DHCPNAK:
+        case DHCPRELEASE:
+        case DHCPINFORM:
+            printf("%s\n", dhcp_type_name(dhcp_message_type(view)));
+            break;
+        default:
+            printf("Desconocido (%d)\n", dhcp_message_type(view));
+            break;
+    }
 
-            // Otras opciones como la máscara de subred, puerta de enlace, DNS, etc.
-        }
+    if (dhcp_option_u32(view, OPT_LEASE_TIME, &value)) { // Tiempo de concesión (lease time)
+        lease_time = ntohl(value); // Convertir de formato de red a formato local
+        printf("Tiempo de concesión: %u segundos\n", lease_time);
+        lease_start_time = time(NULL); // Guardar el momento en que se asigna la IP
+        lease_start_ns = now_ns();
+    }
+    renewal_time = dhcp_option_u32(view, OPT_RENEWAL_TIME, &value) ? ntohl(value) : 0;
+    rebinding_time = dhcp_option_u32(view, OPT_REBINDING_TIME, &value) ? ntohl(value) : 0;
 
-        offset += option_length; // Mover el offset al siguiente par código-longitud
+    if (dhcp_option_u32(view, OPT_SERVER_ID, &value)) {
+        server_id = value;
     }
+    // Otras opciones como la máscara de subred, puerta de enlace, DNS, etc.
 }
 
 // Función para calcular el tiempo de renovación (T1)
 int time_to_renew() {
+    if (renewal_time > 0 && renewal_time < lease_time) {
+        return renewal_time;
+    }
     return (lease_time / 2); // T1: 50% del tiempo de concesión
 }
 
-// Función para renovar la IP enviando DHCPREQUEST
-void renew_ip(int sockfd, struct sockaddr_in *server_addr, socklen_t addr_len, const char *client_mac, const char *requested_ip) {
-    dhcp_message msg;
-    memset(&msg, 0, sizeof(msg));
-    msg.message_type = 3; // 3 = DHCPREQUEST
-    strcpy(msg.client_mac, client_mac);
-    strcpy(msg.requested_ip, requested_ip);
+// Tiempo de reenlace (T2): si el servidor no responde a la renovación se pide a cualquiera
+int time_to_rebind() {
+    if (rebinding_time > (uint32_t)time_to_renew() && rebinding_time < lease_time) {
+        return rebinding_time;
+    }
+    return (lease_time / 8 * 7); // T2: 87,5% del tiempo de concesión
+}
 
-    printf("Renovando IP %s...\n", requested_ip);
-    if (sendto(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)server_addr, addr_len) < 0) {
-        perror("Error al enviar DHCPREQUEST para renovar");
-    } else {
-        printf("DHCPREQUEST enviado para renovar IP %s\n", requested_ip);
+// Espera hasta el instante deadline_ns del reloj monótono
+void sleep_until(uint64_t deadline_ns) {
+    struct timespec ts = {deadline_ns / 1000000000ULL, deadline_ns % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+// Función para preparar el DHCPREQUEST de renovación (o de reenlace, por difusión)
+size_t renew_ip(dhcp_packet *msg, int rebinding, const char *requested_ip) {
+    size_t pos = build_request(msg, CLIENT_MAC, random(), DHCPREQUEST);
+    msg->ciaddr = assigned_addr; // En renovación la IP va en ciaddr, sin opciones 50 ni 54
+    if (rebinding) {
+        msg->flags = htons(DHCP_FLAG_BROADCAST);
     }
+    printf("%s IP %s...\n", rebinding ? "Reenlazando" : "Renovando", requested_ip);
+    return pos;
 }
 
-// Función para manejar la respuesta del servidor durante la renovación
-int handle_renewal_response(int sockfd, struct sockaddr_in *server_addr, socklen_t addr_len) {
-    dhcp_message response;
+// Función para renovar el lease antes de deadline_ns, retransmitiendo mientras no haya respuesta
+int handle_renewal_response(int rebinding, uint64_t deadline_ns) {
+    dhcp_packet msg, response;
+    dhcp_view view;
 
-    if (recvfrom(sockfd, &response, sizeof(response), 0, (struct sockaddr*)server_addr, &addr_len) < 0) {
-        perror("Error al recibir respuesta del servidor durante la renovación");
-        return -1;  // Error en la renovación
+    size_t pos = renew_ip(&msg, rebinding, assigned_ip);
+    int type = exchange(&msg, pos, "DHCPREQUEST", deadline_ns, 1, &response, &view);
+    if (type < 0) {
+        return -1;  // Sin respuesta antes del plazo
     }
 
-    if (response.message_type == 4) { // DHCPACK
+    if (type == DHCPACK) {
         printf("Renovación de IP aceptada (DHCPACK recibido)\n");
+        print_dhcp_options(&view);
         return 1;  // Renovación exitosa
-    } else if (response.message_type == 5) { // DHCPNAK
+    } else if (type == DHCPNAK) {
         printf("Renovación de IP rechazada (DHCPNAK recibido)\n");
         return 0;  // Renovación rechazada
     }
@@ -148,10 +241,939 @@ int handle_renewal_response(int sockfd, struct sockaddr_in *server_addr, socklen
     return -1;  // Respuesta inesperada
 }
 
-int main() {
+// Obtiene una IP (DISCOVER, OFFER, REQUEST, ACK) antes de deadline_ns. Una oferta que no se
+// confirma en request_limit_ns o un DHCPNAK vuelven a empezar desde DHCPDISCOVER;
+// devuelve 0 si se obtuvo la IP o -1 si venció el plazo
+int acquire_lease(uint64_t deadline_ns, uint64_t request_limit_ns) {
+    dhcp_packet msg, response;
+    dhcp_view view;
+    size_t pos;
+
+    while (now_ns() < deadline_ns) {
+        // Enviar mensaje DHCPDISCOVER al servidor y esperar el DHCPOFFER
+        uint32_t xid = random();
+        pos = build_request(&msg, CLIENT_MAC, xid, DHCPDISCOVER);
+        printf("Enviando DHCPDISCOVER al servidor...\n");
+        int type = exchange(&msg, pos, "DHCPDISCOVER", deadline_ns, 0, &response, &view);
+        if (type < 0) {
+            break;
+        }
+        if (type != DHCPOFFER) {
+            continue;
+        }
+
+        assigned_addr = response.yiaddr; // Guardar la IP asignada
+        inet_ntop(AF_INET, &assigned_addr, assigned_ip, sizeof(assigned_ip));
+        printf("Recibido DHCPOFFER: %s\n", assigned_ip);
+        print_dhcp_options(&view);
+
+        // Enviar mensaje DHCPREQUEST para solicitar la IP ofrecida
+        pos = build_request(&msg, CLIENT_MAC, xid, DHCPREQUEST);
+        dhcp_put_option(&msg, &pos, OPT_REQUESTED_IP, 4, &assigned_addr);
+        dhcp_put_option(&msg, &pos, OPT_SERVER_ID, 4, &server_id);
+        printf("Enviando DHCPREQUEST al servidor para la IP %s...\n", assigned_ip);
+
+        uint64_t request_deadline = now_ns() + request_limit_ns;
+        type = exchange(&msg, pos, "DHCPREQUEST", request_deadline < deadline_ns ? request_deadline : deadline_ns,
+                        0, &response, &view);
+        if (type == DHCPACK) {
+            printf("Recibido DHCPACK: IP asignada %s\n", assigned_ip);
+            print_dhcp_options(&view);
+            return 0;
+        }
+        printf("%s; se vuelve a empezar con DHCPDISCOVER\n",
+               type == DHCPNAK ? "Oferta rechazada (DHCPNAK recibido)" : "Sin confirmación de la oferta");
+        assigned_addr = 0;
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Generador de carga: simula muchos clientes desde un único proceso con un
+// bucle de eventos no bloqueante. Cada cliente tiene como mucho una
+// transacción en curso; su índice viaja en los 24 bits bajos del xid.
+// ---------------------------------------------------------------------------
+
+#define LOAD_MAX_CLIENTS (1 << 24)
+#define LOAD_MAC_BASE 0x020000000000ULL  // MACs administradas localmente
+#define HIST_SUB_BITS 4                  // 16 subcubos por potencia de dos
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+// Estado de un cliente simulado; cada estado tiene su propia lista de clientes
+enum { SIM_LIBRE, SIM_OFRECIDO, SIM_LIGADO, SIM_EN_CURSO, SIM_ESTADOS };
+
+// Operaciones de la mezcla de carga
+enum { OP_DISCOVER, OP_REQUEST, OP_RENEW, OP_RELEASE, OP_TIPOS };
+
+typedef struct {
+    uint32_t xid;          // xid de la transacción en curso
+    uint32_t ip;           // IP ofrecida o concedida (orden de red)
+    uint32_t server_id;    // Opción 54 de la oferta
+    uint8_t state;
+    uint8_t op;            // Operación en curso
+    uint8_t seq;           // Se incrementa en cada transacción (bits altos del xid)
+    uint32_t list_pos;     // Posición dentro de la lista de su estado
+    uint64_t sent_ns;      // Momento del envío de la transacción en curso
+} sim_client;
+
+// Transacción pendiente en la cola de expiración (el timeout es uniforme,
+// así que basta una cola FIFO en orden de envío)
+typedef struct {
+    uint32_t xid;
+    uint64_t deadline_ns;
+} sim_pending;
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+} latency_hist;
+
+sim_client *sim_clients;
+uint32_t sim_count;
+uint32_t *state_list[SIM_ESTADOS]; // Índices de clientes por estado
+uint32_t state_len[SIM_ESTADOS];
+sim_pending *pending_ring;
+uint32_t pending_mask, pending_head, pending_tail;
+latency_hist load_hist;
+volatile sig_atomic_t load_running = 1;
+
+uint64_t op_sent[OP_TIPOS], op_skipped[OP_TIPOS];
+uint64_t offers, acks, naks, timeouts, stray_replies;
+
+static const char *op_names[OP_TIPOS] = {"DISCOVER", "REQUEST", "RENEW", "RELEASE"};
+
+// Generador xorshift: random() es demasiado lento y serializado para esto
+uint64_t rng_state = 88172645463325252ULL;
+uint64_t fast_rand() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Histograma log-lineal: error relativo acotado (~6%) en todo el rango
+int hist_bucket(uint64_t value) {
+    if (value < (1 << HIST_SUB_BITS)) {
+        return value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (value >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+uint64_t hist_bucket_value(int bucket) {
+    int exp = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    int sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+    if (bucket < (1 << HIST_SUB_BITS)) {
+        return bucket;
+    }
+    return (1ULL << exp) | ((uint64_t)sub << (exp - HIST_SUB_BITS));
+}
+
+void hist_record(latency_hist *hist, uint64_t value) {
+    hist->counts[hist_bucket(value)]++;
+    hist->total++;
+}
+
+uint64_t hist_percentile(const latency_hist *hist, double percentile) {
+    uint64_t target = (uint64_t)(hist->total * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > target) {
+            return hist_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+// Mueve un cliente a otro estado en O(1) (borrado por intercambio con el último)
+void sim_set_state(uint32_t idx, uint8_t state) {
+    sim_client *c = &sim_clients[idx];
+    uint32_t *list = state_list[c->state];
+    uint32_t last = list[--state_len[c->state]];
+    list[c->list_pos] = last;
+    sim_clients[last].list_pos = c->list_pos;
+
+    c->state = state;
+    c->list_pos = state_len[state];
+    state_list[state][state_len[state]++] = idx;
+}
+
+// Elige una operación según los pesos de la mezcla
+int pick_operation(const unsigned *mix, unsigned mix_total) {
+    unsigned r = fast_rand() % mix_total;
+    for (int op = 0; op < OP_TIPOS; op++) {
+        if (r < mix[op]) {
+            return op;
+        }
+        r -= mix[op];
+    }
+    return OP_DISCOVER;
+}
+
+// Da por perdida la transacción xid si sigue en curso (ya respondida o sustituida: nada)
+static void sim_timeout(uint32_t xid) {
+    uint32_t idx = xid & (LOAD_MAX_CLIENTS - 1);
+    sim_client *c = &sim_clients[idx];
+
+    if (c->state == SIM_EN_CURSO && c->xid == xid) {
+        timeouts++;
+        // Una renovación sin respuesta conserva el lease; el resto vuelve a empezar
+        sim_set_state(idx, c->op == OP_RENEW ? SIM_LIGADO : SIM_LIBRE);
+    }
+}
+
+// Lanza una transacción; devuelve 0 si no hay ningún cliente en el estado adecuado
+int sim_start(int sockfd, int op, uint64_t timeout_ns) {
+    static const uint8_t needed[OP_TIPOS] = {SIM_LIBRE, SIM_OFRECIDO, SIM_LIGADO, SIM_LIGADO};
+    uint8_t state = needed[op];
+    dhcp_packet msg;
+    size_t pos;
+
+    if (state_len[state] == 0) {
+        op_skipped[op]++;
+        return 0;
+    }
+    uint32_t idx = state_list[state][fast_rand() % state_len[state]];
+    sim_client *c = &sim_clients[idx];
+    uint32_t xid = ((uint32_t)++c->seq << 24) | idx;
+
+    switch (op) {
+        case OP_DISCOVER:
+            pos = build_request(&msg, LOAD_MAC_BASE + idx, xid, DHCPDISCOVER);
+            break;
+        case OP_REQUEST:
+            pos = build_request(&msg, LOAD_MAC_BASE + idx, xid, DHCPREQUEST);
+            dhcp_put_option(&msg, &pos, OPT_REQUESTED_IP, 4, &c->ip);
+            dhcp_put_option(&msg, &pos, OPT_SERVER_ID, 4, &c->server_id);
+            break;
+        case OP_RENEW:
+            pos = build_request(&msg, LOAD_MAC_BASE + idx, xid, DHCPREQUEST);
+            msg.ciaddr = c->ip;
+            break;
+        default:
+            pos = build_request(&msg, LOAD_MAC_BASE + idx, xid, DHCPRELEASE);
+            msg.ciaddr = c->ip;
+            dhcp_put_option(&msg, &pos, OPT_SERVER_ID, 4, &c->server_id);
+            break;
+    }
+
+    if (sendto(sockfd, &msg, dhcp_finish(&msg, pos), 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("Error al enviar solicitud");
+        }
+        op_skipped[op]++;
+        return 0;
+    }
+    op_sent[op]++;
+
+    // DHCPRELEASE no tiene respuesta: el cliente queda libre en el acto
+    if (op == OP_RELEASE) {
+        sim_set_state(idx, SIM_LIBRE);
+        return 1;
+    }
+
+    c->xid = xid;
+    c->op = op;
+    c->sent_ns = now_ns();
+    sim_set_state(idx, SIM_EN_CURSO);
+
+    // Si la cola de expiración está llena, la entrada más antigua ya ha vencido
+    // o está a punto: se anticipa su expiración antes de ocupar su lugar
+    if (pending_tail - pending_head > pending_mask) {
+        sim_timeout(pending_ring[pending_head & pending_mask].xid);
+        pending_head++;
+    }
+    pending_ring[pending_tail & pending_mask] = (sim_pending){xid, c->sent_ns + timeout_ns};
+    pending_tail++;
+    return 1;
+}
+
+// Procesa todas las respuestas disponibles en el socket
+void sim_receive(int sockfd) {
+    dhcp_packet response;
+    dhcp_view view;
+    ssize_t len;
+
+    while ((len = recv(sockfd, &response, sizeof(response), 0)) >= 0) {
+        if (dhcp_parse(&response, len, &view) < 0 || response.op != BOOTREPLY) {
+            stray_replies++;
+            continue;
+        }
+        uint32_t idx = response.xid & (LOAD_MAX_CLIENTS - 1);
+        if (idx >= sim_count || sim_clients[idx].state != SIM_EN_CURSO || sim_clients[idx].xid != response.xid) {
+            stray_replies++;  // Respuesta tardía a una transacción ya expirada
+            continue;
+        }
+
+        sim_client *c = &sim_clients[idx];
+        hist_record(&load_hist, now_ns() - c->sent_ns);
+        switch (dhcp_message_type(&view)) {
+            case DHCPOFFER:
+                offers++;
+                c->ip = response.yiaddr;
+                dhcp_option_u32(&view, OPT_SERVER_ID, &c->server_id);
+                sim_set_state(idx, SIM_OFRECIDO);
+                break;
+            case DHCPACK:
+                acks++;
+                sim_set_state(idx, SIM_LIGADO);
+                break;
+            case DHCPNAK:
+                naks++;
+                sim_set_state(idx, SIM_LIBRE);
+                break;
+            default:
+                stray_replies++;
+                break;
+        }
+    }
+}
+
+// Expira las transacciones sin respuesta cuyo plazo ha vencido
+void sim_expire(uint64_t now) {
+    while (pending_head != pending_tail && pending_ring[pending_head & pending_mask].deadline_ns <= now) {
+        sim_timeout(pending_ring[pending_head & pending_mask].xid);
+        pending_head++;
+    }
+}
+
+void load_signal_handler(int signum) {
+    (void)signum;
+    load_running = 0;
+}
+
+void print_load_report(double elapsed) {
+    uint64_t replies = offers + acks + naks;
+
+    printf("\n--- Resultado de la carga (%.2f s) ---\n", elapsed);
+    for (int op = 0; op < OP_TIPOS; op++) {
+        printf("%-8s enviados %10llu  omitidos %10llu\n", op_names[op],
+               (unsigned long long)op_sent[op], (unsigned long long)op_skipped[op]);
+    }
+    printf("Respuestas: %llu (%.0f/s)  DHCPOFFER %llu  DHCPACK %llu  DHCPNAK %llu\n",
+           (unsigned long long)replies, replies / elapsed, (unsigned long long)offers,
+           (unsigned long long)acks, (unsigned long long)naks);
+    printf("Timeouts: %llu  Respuestas tardías o inesperadas: %llu\n",
+           (unsigned long long)timeouts, (unsigned long long)stray_replies);
+    if (load_hist.total > 0) {
+        printf("Latencia por transacción: p50 %.1f us  p99 %.1f us  p99.9 %.1f us\n",
+               hist_percentile(&load_hist, 50) / 1000.0,
+               hist_percentile(&load_hist, 99) / 1000.0,
+               hist_percentile(&load_hist, 99.9) / 1000.0);
+    }
+}
+
+// Bucle principal del generador: envía a ritmo constante y procesa respuestas
+// y expiraciones sin bloquear. Al acabar la duración espera un timeout más
+// para recoger las respuestas pendientes.
+int run_load(uint32_t clients, double rate, int duration, uint64_t timeout_ns, const unsigned *mix) {
+    unsigned mix_total = mix[0] + mix[1] + mix[2] + mix[3];
+    int rcvbuf = 1 << 22;
+
+    sim_clients = calloc(clients, sizeof(sim_client));
+    sim_count = clients;
+    for (int s = 0; s < SIM_ESTADOS; s++) {
+        state_list[s] = malloc(clients * sizeof(uint32_t));
+    }
+    for (uint32_t i = 0; i < clients; i++) {
+        sim_clients[i].state = SIM_LIBRE;
+        sim_clients[i].list_pos = i;
+        state_list[SIM_LIBRE][i] = i;
+    }
+    state_len[SIM_LIBRE] = clients;
+
+    // La cola de expiración debe cubrir los envíos de un intervalo de timeout
+    uint64_t window = (uint64_t)(rate * (timeout_ns / 1e9)) + clients;
+    uint32_t capacity = 1024;
+    while (capacity < window && capacity < (1U << 30)) {
+        capacity <<= 1;
+    }
+    pending_ring = malloc(capacity * sizeof(sim_pending));
+    pending_mask = capacity - 1;
+
+    if (sim_clients == NULL || pending_ring == NULL || state_list[SIM_EN_CURSO] == NULL) {
+        perror("No se pudo reservar memoria para los clientes simulados");
+        exit(EXIT_FAILURE);
+    }
+
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    signal(SIGINT, load_signal_handler);
+    rng_state ^= now_ns();
+
+    printf("Generando carga: %u clientes, %.0f transacciones/s durante %d s (mezcla %u:%u:%u:%u)\n",
+           clients, rate, duration, mix[0], mix[1], mix[2], mix[3]);
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)duration * 1000000000ULL;
+    uint64_t launched = 0;
+    uint64_t next_report = start + 1000000000ULL;
+    uint64_t now = start;
+    struct pollfd pfd = {sockfd, POLLIN, 0};
+
+    while (load_running && (now < end || (pending_head != pending_tail && now < end + timeout_ns))) {
+        // Lanzar las transacciones que tocan según el ritmo configurado
+        if (now < end) {
+            uint64_t due = (uint64_t)((now - start) / 1e9 * rate);
+            while (launched < due) {
+                sim_start(sockfd, pick_operation(mix, mix_total), timeout_ns);
+                launched++;
+            }
+        }
+
+        poll(&pfd, 1, 1);
+        now = now_ns();
+        if (pfd.revents & POLLIN) {
+            sim_receive(sockfd);
+        }
+        sim_expire(now);
+
+        if (now >= next_report) {
+            printf("[%3llu s] enviados %llu, respuestas %llu, timeouts %llu, ligados %u\n",
+                   (unsigned long long)((now - start) / 1000000000ULL),
+                   (unsigned long long)(op_sent[0] + op_sent[1] + op_sent[2] + op_sent[3]),
+                   (unsigned long long)(offers + acks + naks), (unsigned long long)timeouts,
+                   state_len[SIM_LIGADO]);
+            next_report += 1000000000ULL;
+        }
+    }
+
+    print_load_report((now - start) / 1e9);
+    close(sockfd);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Motor de leases: mantiene muchos leases a la vez (uno por interfaz virtual o
+// contenedor) con un único bucle epoll y sin hilos. Cada lease tiene un único
+// plazo pendiente; los plazos viven en un montículo y un solo timerfd se arma
+// para el más próximo. Al vencer se atienden juntos todos los que caen en la
+// ventana de agrupación y sus mensajes salen con un único sendmmsg.
+// ---------------------------------------------------------------------------
+
+#define ENGINE_MAX_LEASES (1 << 24)            // El índice del lease viaja en los 24 bits bajos del xid
+#define ENGINE_MAC_BASE 0x020100000000ULL      // MACs de las interfaces virtuales
+#define ENGINE_REQUEST_RETRIES 3               // Retransmisiones de un REQUEST antes de volver a INIT
+#define ENGINE_RETRY_NS 2000000000ULL          // Pausa antes de volver a empezar desde INIT
+#define ENGINE_START_RATE 2000                 // Arranques por segundo al iniciar (evita la avalancha)
+#define ENGINE_SLACK_NS 50000000ULL            // Ventana de agrupación de plazos (50 ms)
+#define ENGINE_BATCH 64                        // Mensajes por sendmmsg
+#define ENGINE_STATUS_NS 10000000000ULL        // Intervalo del resumen periódico
+
+// Estados del cliente según RFC 2131 (sección 4.4)
+enum { LEASE_INIT, LEASE_SELECTING, LEASE_REQUESTING, LEASE_BOUND, LEASE_RENEWING, LEASE_REBINDING, LEASE_ESTADOS };
+
+static const char *lease_state_names[LEASE_ESTADOS] = {
+    "INIT", "SELECTING", "REQUESTING", "BOUND", "RENEWING", "REBINDING"
+};
+
+typedef struct {
+    uint64_t mac;
+    uint32_t xid;            // Transacción en curso
+    uint32_t ip;             // IP ofrecida o concedida (orden de red)
+    uint32_t server_id;      // Servidor que la ofreció o concedió (orden de red)
+    uint8_t state;
+    uint8_t seq;             // Bits altos del xid: distinguen transacciones sucesivas
+    uint8_t retries;         // Retransmisiones del mensaje en curso
+    uint32_t heap_pos;       // Posición en el montículo de plazos
+    uint64_t deadline_ns;    // Próximo plazo (reloj monótono)
+    uint64_t t2_ns;          // Inicio del REBINDING
+    uint64_t expiry_ns;      // Fin del lease
+} lease_client;
+
+typedef struct {
+    lease_client *leases;
+    uint32_t count;
+    uint32_t *heap;          // Índices de leases ordenados por plazo (todos están siempre)
+    uint32_t state_count[LEASE_ESTADOS];
+    int sockfd;
+    int timerfd;
+    int verbose;
+    // Tanda de mensajes salientes
+    dhcp_packet out[ENGINE_BATCH];
+    struct iovec iov[ENGINE_BATCH];
+    struct mmsghdr hdrs[ENGINE_BATCH];
+    int pending;
+    // Contadores
+    uint64_t acquired, renewed, rebound, naks, expired, timeouts, retransmits, released, wakeups, timer_events;
+} lease_engine;
+
+volatile sig_atomic_t engine_running = 1;
+
+static int heap_before(const lease_engine *e, uint32_t a, uint32_t b) {
+    return e->leases[a].deadline_ns < e->leases[b].deadline_ns;
+}
+
+static void heap_place(lease_engine *e, uint32_t pos, uint32_t idx) {
+    e->heap[pos] = idx;
+    e->leases[idx].heap_pos = pos;
+}
+
+// Cambia el plazo de un lease y lo recoloca en el montículo en O(log n)
+void engine_schedule(lease_engine *e, uint32_t idx, uint64_t deadline_ns) {
+    uint32_t pos = e->leases[idx].heap_pos;
+    e->leases[idx].deadline_ns = deadline_ns;
+
+    while (pos > 0 && heap_before(e, idx, e->heap[(pos - 1) / 2])) {
+        heap_place(e, pos, e->heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    while (1) {
+        uint32_t child = 2 * pos + 1;
+        if (child >= e->count) {
+            break;
+        }
+        if (child + 1 < e->count && heap_before(e, e->heap[child + 1], e->heap[child])) {
+            child++;
+        }
+        if (!heap_before(e, e->heap[child], idx)) {
+            break;
+        }
+        heap_place(e, pos, e->heap[child]);
+        pos = child;
+    }
+    heap_place(e, pos, idx);
+}
+
+static void engine_set_state(lease_engine *e, uint32_t idx, uint8_t state) {
+    lease_client *l = &e->leases[idx];
+    e->state_count[l->state]--;
+    e->state_count[state]++;
+    if (e->verbose) {
+        char mac[18], ip[INET_ADDRSTRLEN];
+        dhcp_format_mac(l->mac, mac);
+        inet_ntop(AF_INET, &l->ip, ip, sizeof(ip));
+        printf("[%s] %s -> %s (%s)\n", mac, lease_state_names[l->state], lease_state_names[state], ip);
+    }
+    l->state = state;
+}
+
+// Envía los mensajes acumulados con una sola llamada
+void engine_flush(lease_engine *e) {
+    int sent = 0;
+    while (sent < e->pending) {
+        int n = sendmmsg(e->sockfd, e->hdrs + sent, e->pending - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Error al enviar la tanda de mensajes");
+            }
+            break;  // Los perdidos se recuperan por timeout
+        }
+        sent += n;
+    }
+    e->pending = 0;
+}
+
+// Prepara un mensaje del lease en la tanda; devuelve el paquete para completar sus opciones
+static dhcp_packet *engine_message(lease_engine *e, uint32_t idx, uint8_t type, size_t *pos) {
+    if (e->pending == ENGINE_BATCH) {
+        engine_flush(e);
+    }
+    dhcp_packet *msg = &e->out[e->pending];
+    *pos = build_request(msg, e->leases[idx].mac, e->leases[idx].xid, type);
+    return msg;
+}
+
+static void engine_queue(lease_engine *e, dhcp_packet *msg, size_t pos) {
+    e->iov[e->pending].iov_len = dhcp_finish(msg, pos);
+    e->pending++;
+}
+
+static uint32_t engine_new_xid(lease_client *l, uint32_t idx) {
+    l->xid = ((uint32_t)++l->seq << 24) | idx;
+    return l->xid;
+}
+
+// Desviación aleatoria de hasta el 5% hacia abajo (RFC 2131, 4.4.5), para que los
+// leases concedidos a la vez no renueven todos en el mismo instante
+static uint64_t engine_fuzz(uint64_t interval) {
+    return interval - fast_rand() % (interval / 20 + 1);
+}
+
+// Encola el mensaje que corresponde al estado del lease: DISCOVER en SELECTING,
+// REQUEST con las opciones 50 y 54 en REQUESTING, y REQUEST con ciaddr al renovar
+// o reenlazar (este último por difusión)
+static void engine_send(lease_engine *e, uint32_t idx) {
+    lease_client *l = &e->leases[idx];
+    size_t pos;
+    dhcp_packet *msg = engine_message(e, idx, l->state == LEASE_SELECTING ? DHCPDISCOVER : DHCPREQUEST, &pos);
+
+    if (l->state == LEASE_REQUESTING) {
+        dhcp_put_option(msg, &pos, OPT_REQUESTED_IP, 4, &l->ip);
+        dhcp_put_option(msg, &pos, OPT_SERVER_ID, 4, &l->server_id);
+    } else if (l->state != LEASE_SELECTING) {
+        msg->ciaddr = l->ip;
+    }
+    if (l->state == LEASE_REBINDING) {
+        msg->flags = htons(DHCP_FLAG_BROADCAST);
+    }
+    engine_queue(e, msg, pos);
+}
+
+// Próxima retransmisión al renovar o reenlazar: la mitad del tiempo que queda hasta
+// 'limit' (RFC 2131, 4.4.5); si queda poco se espera directamente al plazo
+static uint64_t engine_halfway(uint64_t now, uint64_t limit) {
+    if (limit <= now + 2 * RENEW_MIN_WAIT_NS) {
+        return limit;
+    }
+    return now + (limit - now) / 2;
+}
+
+// Vence el plazo de un lease: cada estado decide el siguiente paso
+void engine_timeout(lease_engine *e, uint32_t idx, uint64_t now) {
+    lease_client *l = &e->leases[idx];
+
+    switch (l->state) {
+        case LEASE_INIT:
+            engine_new_xid(l, idx);
+            l->retries = 0;
+            engine_set_state(e, idx, LEASE_SELECTING);
+            engine_send(e, idx);
+            engine_schedule(e, idx, now + retry_delay(0));
+            break;
+
+        case LEASE_SELECTING:
+            // Sin ofertas: se repite el DISCOVER con el mismo xid y espera creciente
+            e->retransmits++;
+            l->retries += l->retries < 255;
+            engine_send(e, idx);
+            engine_schedule(e, idx, now + retry_delay(l->retries));
+            break;
+
+        case LEASE_REQUESTING:
+            if (l->retries >= ENGINE_REQUEST_RETRIES) {
+                e->timeouts++;
+                engine_set_state(e, idx, LEASE_INIT);
+                engine_schedule(e, idx, now + engine_fuzz(ENGINE_RETRY_NS));
+                break;
+            }
+            e->retransmits++;
+            l->retries++;
+            engine_send(e, idx);
+            engine_schedule(e, idx, now + retry_delay(l->retries));
+            break;
+
+        case LEASE_BOUND:
+            // T1: renovación con el servidor que concedió el lease (ciaddr, sin opciones 50 ni 54)
+            engine_new_xid(l, idx);
+            engine_set_state(e, idx, LEASE_RENEWING);
+            engine_send(e, idx);
+            engine_schedule(e, idx, engine_halfway(now, l->t2_ns));
+            break;
+
+        case LEASE_RENEWING:
+            if (now + ENGINE_SLACK_NS >= l->t2_ns) {
+                // T2: el servidor no respondió; se pide a cualquiera (en una red real, por difusión)
+                engine_new_xid(l, idx);
+                engine_set_state(e, idx, LEASE_REBINDING);
+            } else {
+                e->retransmits++;
+            }
+            engine_send(e, idx);
+            engine_schedule(e, idx, engine_halfway(now, l->state == LEASE_RENEWING ? l->t2_ns : l->expiry_ns));
+            break;
+
+        case LEASE_REBINDING:
+            if (now + ENGINE_SLACK_NS >= l->expiry_ns) {
+                // El lease venció sin respuesta: la interfaz deja de usar la IP
+                e->expired++;
+                l->ip = 0;
+                engine_set_state(e, idx, LEASE_INIT);
+                engine_schedule(e, idx, now + engine_fuzz(ENGINE_RETRY_NS));
+                break;
+            }
+            e->retransmits++;
+            engine_send(e, idx);
+            engine_schedule(e, idx, engine_halfway(now, l->expiry_ns));
+            break;
+    }
+}
+
+// Aplica un DHCPACK: calcula T1, T2 y la expiración y programa la renovación
+static void engine_bind(lease_engine *e, uint32_t idx, const dhcp_view *view, uint64_t now) {
+    lease_client *l = &e->leases[idx];
+    uint32_t value, lease_s = 0, t1_s, t2_s;
+
+    if (dhcp_option_u32(view, OPT_LEASE_TIME, &value)) {
+        lease_s = ntohl(value);
+    }
+    if (lease_s == 0) {
+        lease_s = 1;
+    }
+    t1_s = dhcp_option_u32(view, OPT_RENEWAL_TIME, &value) ? ntohl(value) : 0;
+    t2_s = dhcp_option_u32(view, OPT_REBINDING_TIME, &value) ? ntohl(value) : 0;
+
+    uint64_t lease_ns = (uint64_t)lease_s * 1000000000ULL;
+    uint64_t t1_ns = (t1_s > 0 && t1_s < lease_s) ? (uint64_t)t1_s * 1000000000ULL : engine_fuzz(lease_ns / 2);
+    uint64_t t2_ns = (t2_s > 0 && t2_s < lease_s) ? (uint64_t)t2_s * 1000000000ULL : engine_fuzz(lease_ns / 8 * 7);
+    if (t2_ns <= t1_ns) {
+        t2_ns = t1_ns + (lease_ns - t1_ns) / 2;
+    }
+
+    switch (l->state) {
+        case LEASE_REQUESTING: e->acquired++; break;
+        case LEASE_RENEWING: e->renewed++; break;
+        default: e->rebound++; break;
+    }
+    if (l->state != LEASE_REQUESTING) {
+        dhcp_option_u32(view, OPT_SERVER_ID, &l->server_id);
+    }
+    l->t2_ns = now + t2_ns;
+    l->expiry_ns = now + lease_ns;
+    engine_set_state(e, idx, LEASE_BOUND);
+    engine_schedule(e, idx, now + t1_ns);
+}
+
+// Procesa todas las respuestas disponibles en el socket
+void engine_receive(lease_engine *e, uint64_t now) {
+    dhcp_packet response;
+    dhcp_view view;
+    ssize_t len;
+
+    while ((len = recv(e->sockfd, &response, sizeof(response), 0)) >= 0) {
+        if (dhcp_parse(&response, len, &view) < 0 || response.op != BOOTREPLY) {
+            continue;
+        }
+        uint32_t idx = response.xid & (ENGINE_MAX_LEASES - 1);
+        if (idx >= e->count || e->leases[idx].xid != response.xid) {
+            continue;  // Respuesta tardía a una transacción ya terminada
+        }
+        lease_client *l = &e->leases[idx];
+        int type = dhcp_message_type(&view);
+
+        if (type == DHCPOFFER && l->state == LEASE_SELECTING) {
+            // Se acepta la primera oferta: REQUEST con el mismo xid y las opciones 50 y 54
+            l->ip = response.yiaddr;
+            l->retries = 0;
+            dhcp_option_u32(&view, OPT_SERVER_ID, &l->server_id);
+            engine_set_state(e, idx, LEASE_REQUESTING);
+            engine_send(e, idx);
+            engine_schedule(e, idx, now + retry_delay(0));
+        } else if (type == DHCPACK && l->state >= LEASE_REQUESTING && l->state != LEASE_BOUND) {
+            engine_bind(e, idx, &view, now);
+        } else if (type == DHCPNAK && l->state >= LEASE_REQUESTING && l->state != LEASE_BOUND) {
+            e->naks++;
+            l->ip = 0;
+            engine_set_state(e, idx, LEASE_INIT);
+            engine_schedule(e, idx, now + engine_fuzz(ENGINE_RETRY_NS));
+        }
+    }
+}
+
+// Arma el timerfd para el plazo más próximo (tiempo absoluto del reloj monótono)
+static void engine_arm(lease_engine *e) {
+    uint64_t deadline = e->leases[e->heap[0]].deadline_ns;
+    struct itimerspec spec = {{0, 0}, {deadline / 1000000000ULL, deadline % 1000000000ULL}};
+    if (deadline == 0) {
+        spec.it_value.tv_nsec = 1;  // Un valor cero desarmaría el temporizador
+    }
+    timerfd_settime(e->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// Atiende en una tanda todos los plazos vencidos o que vencen dentro de la ventana
+void engine_run_timers(lease_engine *e, uint64_t now) {
+    while (e->leases[e->heap[0]].deadline_ns <= now + ENGINE_SLACK_NS) {
+        engine_timeout(e, e->heap[0], now);
+        e->timer_events++;
+    }
+}
+
+static void engine_signal_handler(int signum) {
+    (void)signum;
+    engine_running = 0;
+}
+
+void print_engine_status(const lease_engine *e, double elapsed) {
+    printf("[%6.0f s] ", elapsed);
+    for (int s = 0; s < LEASE_ESTADOS; s++) {
+        printf("%s %u%s", lease_state_names[s], e->state_count[s], s + 1 < LEASE_ESTADOS ? ", " : "\n");
+    }
+}
+
+void print_engine_report(const lease_engine *e, double elapsed) {
+    printf("\n--- Motor de leases (%.2f s, %u interfaces) ---\n", elapsed, e->count);
+    printf("Concedidos %llu  renovados %llu  reenlazados %llu  DHCPNAK %llu  vencidos %llu  timeouts %llu  liberados %llu\n",
+           (unsigned long long)e->acquired, (unsigned long long)e->renewed, (unsigned long long)e->rebound,
+           (unsigned long long)e->naks, (unsigned long long)e->expired, (unsigned long long)e->timeouts,
+           (unsigned long long)e->released);
+    printf("Retransmisiones: %llu\n", (unsigned long long)e->retransmits);
+    printf("Despertares del temporizador: %llu para %llu plazos (%.1f plazos por despertar)\n",
+           (unsigned long long)e->wakeups, (unsigned long long)e->timer_events,
+           e->wakeups ? (double)e->timer_events / e->wakeups : 0.0);
+}
+
+// Ejecuta el motor con 'count' interfaces hasta recibir SIGINT o SIGTERM; al terminar
+// libera todos los leases vigentes
+int run_engine(uint32_t count, int verbose) {
+    lease_engine *e = calloc(1, sizeof(lease_engine));
+    struct epoll_event ev, events[2];
+    int rcvbuf = 1 << 22;
+
+    if (e == NULL) {
+        perror("No se pudo reservar memoria para el motor de leases");
+        exit(EXIT_FAILURE);
+    }
+    e->count = count;
+    e->verbose = verbose;
+    e->sockfd = sockfd;
+    e->leases = calloc(count, sizeof(lease_client));
+    e->heap = malloc(count * sizeof(uint32_t));
+    if (e->leases == NULL || e->heap == NULL) {
+        perror("No se pudo reservar memoria para los leases");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < ENGINE_BATCH; i++) {
+        e->iov[i].iov_base = &e->out[i];
+        e->hdrs[i].msg_hdr.msg_name = &server_addr;
+        e->hdrs[i].msg_hdr.msg_namelen = addr_len;
+        e->hdrs[i].msg_hdr.msg_iov = &e->iov[i];
+        e->hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Arranques escalonados: todas las interfaces empiezan en INIT a ritmo acotado
+    rng_state ^= now_ns();
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        e->leases[i].mac = (count == 1 ? CLIENT_MAC : ENGINE_MAC_BASE + i);
+        e->leases[i].state = LEASE_INIT;
+        e->leases[i].deadline_ns = start + (uint64_t)i * 1000000000ULL / ENGINE_START_RATE;
+        heap_place(e, i, i);  // Plazos crecientes: el vector ya es un montículo
+    }
+    e->state_count[LEASE_INIT] = count;
+
+    e->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    int epfd = epoll_create1(0);
+    if (e->timerfd < 0 || epfd < 0) {
+        perror("No se pudo crear el temporizador o epoll");
+        exit(EXIT_FAILURE);
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev);
+    ev.data.fd = e->timerfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, e->timerfd, &ev);
+    signal(SIGINT, engine_signal_handler);
+    signal(SIGTERM, engine_signal_handler);
+
+    printf("Motor de leases: %u interfaces, un único bucle epoll con timerfd\n", count);
+
+    uint64_t next_status = start + ENGINE_STATUS_NS;
+    uint64_t now = start;
+    engine_arm(e);
+    while (engine_running) {
+        int wait_ms = next_status > now ? (int)((next_status - now) / 1000000ULL) + 1 : 0;
+        int n = epoll_wait(epfd, events, 2, wait_ms);
+        if (n < 0 && errno != EINTR) {
+            perror("Error en epoll_wait");
+            break;
+        }
+        now = now_ns();
+        for (int k = 0; k < n; k++) {
+            if (events[k].data.fd == e->timerfd) {
+                uint64_t expirations;
+                if (read(e->timerfd, &expirations, sizeof(expirations)) > 0) {
+                    e->wakeups++;
+                    engine_run_timers(e, now);
+                }
+            } else {
+                engine_receive(e, now);
+            }
+        }
+        engine_flush(e);
+        engine_arm(e);
+
+        if (now >= next_status) {
+            print_engine_status(e, (now - start) / 1e9);
+            next_status += ENGINE_STATUS_NS;
+        }
+    }
+
+    // Se liberan los leases vigentes antes de salir
+    for (uint32_t i = 0; i < count; i++) {
+        lease_client *l = &e->leases[i];
+        size_t pos;
+        if (l->state < LEASE_BOUND) {
+            continue;
+        }
+        engine_new_xid(l, i);
+        dhcp_packet *msg = engine_message(e, i, DHCPRELEASE, &pos);
+        msg->ciaddr = l->ip;
+        dhcp_put_option(msg, &pos, OPT_SERVER_ID, 4, &l->server_id);
+        engine_queue(e, msg, pos);
+        e->released++;
+    }
+    engine_flush(e);
+
+    print_engine_report(e, (now_ns() - start) / 1e9);
+    close(epfd);
+    close(e->timerfd);
+    close(sockfd);
+    free(e->leases);
+    free(e->heap);
+    free(e);
+    return 0;
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-a ip] [-p puerto] [-c clientes -r tasa -t segundos -T timeout_ms -x d:r:n:l] [-d interfaces [-v]] [-w s[:s]]\n", prog);
+    fprintf(stderr, "  Sin -c ni -d se ejecuta un único cliente interactivo.\n");
+    fprintf(stderr, "  -d: mantiene un lease por interfaz virtual con renovación (T1) y reenlace (T2) hasta Ctrl + C\n");
+    fprintf(stderr, "  -w: plazo en segundos para obtener una IP y para confirmar cada oferta (por defecto %d:%d)\n",
+            ACQUIRE_DEADLINE_S, REQUEST_DEADLINE_S);
+    fprintf(stderr, "  -x: pesos de DISCOVER, REQUEST, RENEW y RELEASE en la mezcla (por defecto 40:40:15:5)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
     int renewals = 0;  // Contador de renovaciones
     struct sockaddr_in client_addr;
-    dhcp_message msg, response;
+    const char *server_ip = SERVER_IP;
+    int server_port = SERVER_PORT;
+    uint32_t load_clients = 0;
+    double load_rate = 1000;
+    int load_duration = 10;
+    unsigned load_timeout_ms = 1000;
+    unsigned mix[OP_TIPOS] = {40, 40, 15, 5};
+    uint32_t engine_leases = 0;
+    int verbose = 0;
+    unsigned acquire_s = ACQUIRE_DEADLINE_S;
+    unsigned request_s = REQUEST_DEADLINE_S;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "a:p:c:r:t:T:x:d:vw:")) != -1) {
+        switch (opt) {
+            case 'a': server_ip = optarg; break;
+            case 'p': server_port = atoi(optarg); break;
+            case 'c': load_clients = strtoul(optarg, NULL, 10); break;
+            case 'r': load_rate = atof(optarg); break;
+            case 't': load_duration = atoi(optarg); break;
+            case 'T': load_timeout_ms = atoi(optarg); break;
+            case 'x':
+                if (sscanf(optarg, "%u:%u:%u:%u", &mix[0], &mix[1], &mix[2], &mix[3]) != 4) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'd': engine_leases = strtoul(optarg, NULL, 10); break;
+            case 'v': verbose = 1; break;
+            case 'w':
+                if (sscanf(optarg, "%u:%u", &acquire_s, &request_s) < 1 || acquire_s == 0 || request_s == 0) {
+                    usage(argv[0]);
+                }
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (load_clients > LOAD_MAX_CLIENTS || engine_leases > ENGINE_MAX_LEASES || load_rate <= 0 || load_duration <= 0 ||
+        mix[0] + mix[1] + mix[2] + mix[3] == 0) {
+        usage(argv[0]);
+    }
 
     // Crear el socket UDP
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -175,75 +1197,62 @@ int main() {
     // Configurar la dirección del servidor
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
-
-    // Manejar la señal para enviar DHCPRELEASE al terminar
-    signal(SIGINT, signal_handler);
-
-    // Enviar mensaje DHCPDISCOVER al servidor
-    msg.message_type = 1; // 1 = DHCPDISCOVER
-    strcpy(msg.client_mac, "00:11:22:33:44:55"); // Simulación de la MAC
-    printf("Enviando DHCPDISCOVER al servidor...\n");
-
-    if (sendto(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
-        perror("Error al enviar DHCPDISCOVER");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    server_addr.sin_port = htons(server_port);
+    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) != 1) {
+        usage(argv[0]);
     }
 
-    // Esperar respuesta del servidor (DHCPOFFER)
-    if (recvfrom(sockfd, &response, sizeof(response), 0, (struct sockaddr*)&server_addr, &addr_len) < 0) {
-        perror("Error al recibir respuesta del servidor");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    // Modo generador de carga
+    if (load_clients > 0) {
+        return run_load(load_clients, load_rate, load_duration, (uint64_t)load_timeout_ms * 1000000ULL, mix);
     }
 
-    printf("Recibido DHCPOFFER: %s\n", response.requested_ip);
-    print_dhcp_options(&response);
-    strcpy(assigned_ip, response.requested_ip); // Guardar la IP asignada
-
-    // Enviar mensaje DHCPREQUEST para solicitar la IP ofrecida
-    msg.message_type = 3; // 3 = DHCPREQUEST
-    strcpy(msg.requested_ip, response.requested_ip);
-    printf("Enviando DHCPREQUEST al servidor para la IP %s...\n", msg.requested_ip);
-
-    if (sendto(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
-        perror("Error al enviar DHCPREQUEST");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    // Modo demonio: muchos leases en un único bucle de eventos
+    if (engine_leases > 0) {
+        return run_engine(engine_leases, verbose);
     }
 
-    // Esperar respuesta del servidor (DHCPACK)
-    if (recvfrom(sockfd, &response, sizeof(response), 0, (struct sockaddr*)&server_addr, &addr_len) < 0) {
-        perror("Error al recibir DHCPACK");
+    // Manejar la señal para enviar DHCPRELEASE al terminar
+    signal(SIGINT, signal_handler);
+    srandom(time(NULL) ^ getpid());
+
+    // Obtener la IP con un plazo acotado aunque se pierdan mensajes
+    if (acquire_lease(now_ns() + acquire_s * 1000000000ULL, request_s * 1000000000ULL) < 0) {
+        fprintf(stderr, "No se obtuvo una IP en %u segundos\n", acquire_s);
         close(sockfd);
         exit(EXIT_FAILURE);
     }
 
-    printf("Recibido DHCPACK: IP asignada %s\n", response.requested_ip);
-    print_dhcp_options(&response);
-
-    // Temporizador para la renovación
-    int renew_interval = time_to_renew();
-    printf("Renovación programada para %d segundos\n", renew_interval);
-
     // Intentar renovar la IP hasta un máximo de 4 veces
     while (renewals < MAX_RENEWALS) {
-        sleep(renew_interval); // Simular espera hasta que llegue el tiempo de renovación
-        renew_ip(sockfd, &server_addr, addr_len, "00:11:22:33:44:55", response.requested_ip);
+        // Temporizadores del lease: T1 (renovación), T2 (reenlace) y expiración
+        uint64_t t1 = lease_start_ns + (uint64_t)time_to_renew() * 1000000000ULL;
+        uint64_t t2 = lease_start_ns + (uint64_t)time_to_rebind() * 1000000000ULL;
+        uint64_t expiry = lease_start_ns + (uint64_t)lease_time * 1000000000ULL;
+        printf("Renovación programada para %d segundos\n", time_to_renew());
+
+        sleep_until(t1); // Esperar hasta que llegue el tiempo de renovación
+        int renewal_status = handle_renewal_response(0, t2);
+        if (renewal_status < 0) {
+            printf("El servidor no responde; se intenta reenlazar con cualquier servidor\n");
+            renewal_status = handle_renewal_response(1, expiry);
+        }
 
-        int renewal_status = handle_renewal_response(sockfd, &server_addr, addr_len);
         if (renewal_status == 1) {
             renewals++;
             printf("Renovación #%d exitosa\n", renewals);
-            renew_interval = time_to_renew();  // Volver a programar la próxima renovación
-        } else if (renewal_status == 0) {
-            printf("Renovación fallida, se ha recibido un DHCPNAK. Fin del proceso.\n");
-            break;
+            continue;
+        }
+        if (renewal_status == 0) {
+            printf("Renovación fallida, se ha recibido un DHCPNAK. Se solicita una IP nueva.\n");
         } else {
-            printf("Error en la renovación. Fin del proceso.\n");
-            break;
+            printf("El lease ha vencido sin respuesta. Se solicita una IP nueva.\n");
+        }
+        assigned_addr = 0;
+        if (acquire_lease(now_ns() + acquire_s * 1000000000ULL, request_s * 1000000000ULL) < 0) {
+            fprintf(stderr, "No se obtuvo una IP en %u segundos\n", acquire_s);
+            close(sockfd);
+            exit(EXIT_FAILURE);
         }
     }
 
@@ -0,0 +1,252 @@
+#ifndef CODEC_DHCP_H
+#define CODEC_DHCP_H
+
+// Codificación y decodificación del formato de red BOOTP/DHCP (RFC 951, RFC 2131).
+// Compartido por el servidor, el cliente y el relay. Solo cabecera: cada programa
+// se sigue compilando con una única orden.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_FIXED_LEN 236          // Cabecera BOOTP fija
+#define DHCP_OPTIONS_START 240      // Cabecera + cookie mágica
+#define DHCP_MAGIC_COOKIE 0x63825363
+#define DHCP_MIN_PACKET 300         // Tamaño mínimo de un mensaje BOOTP
+#define DHCP_MAX_PACKET 1500
+#define DHCP_MAX_HOPS 16
+
+#define BOOTREQUEST 1
+#define BOOTREPLY 2
+#define DHCP_FLAG_BROADCAST 0x8000
+
+// Tipos de mensaje (opción 53)
+#define DHCPDISCOVER 1
+#define DHCPOFFER 2
+#define DHCPREQUEST 3
+#define DHCPDECLINE 4
+#define DHCPACK 5
+#define DHCPNAK 6
+#define DHCPRELEASE 7
+#define DHCPINFORM 8
+#define DHCPLEASEQUERY 10           // Consulta de leases (RFC 4388)
+#define DHCPLEASEUNASSIGNED 11
+#define DHCPLEASEUNKNOWN 12
+#define DHCPLEASEACTIVE 13
+
+// Códigos de opción usados en el proyecto
+#define OPT_PAD 0
+#define OPT_SUBNET_MASK 1
+#define OPT_ROUTER 3
+#define OPT_DNS 6
+#define OPT_DOMAIN_NAME 15
+#define OPT_NTP 42
+#define OPT_REQUESTED_IP 50
+#define OPT_LEASE_TIME 51
+#define OPT_OVERLOAD 52
+#define OPT_MESSAGE_TYPE 53
+#define OPT_SERVER_ID 54
+#define OPT_RENEWAL_TIME 58         // T1
+#define OPT_REBINDING_TIME 59       // T2
+#define OPT_CLIENT_ID 61
+#define OPT_CLIENT_LAST_TRANSACTION 91  // Segundos desde la última transacción del cliente
+#define OPT_ASSOCIATED_IP 92        // Todas las IPs con lease del cliente
+#define OPT_CLASSLESS_ROUTES 121
+#define OPT_END 255
+
+// Mensaje en el formato de red. Los campos multibyte van en orden de red.
+typedef struct __attribute__((packed)) {
+    uint8_t op;
+    uint8_t htype;
+    uint8_t hlen;
+    uint8_t hops;
+    uint32_t xid;
+    uint16_t secs;
+    uint16_t flags;
+    uint32_t ciaddr;
+    uint32_t yiaddr;
+    uint32_t siaddr;
+    uint32_t giaddr;
+    uint8_t chaddr[16];
+    char sname[64];
+    char file[128];
+    uint32_t cookie;
+    uint8_t options[DHCP_MAX_PACKET - DHCP_OPTIONS_START];
+} dhcp_packet;
+
+// Vista de un mensaje recibido: las opciones no se copian, solo se anota la
+// posición de su valor dentro del búfer de recepción (0 = ausente)
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    uint16_t offset[256];
+} dhcp_view;
+
+// Recorre una zona TLV anotando las opciones; devuelve -1 si está mal formada
+static inline int dhcp_walk_options(dhcp_view *view, size_t pos, size_t end) {
+    const uint8_t *buf = view->buf;
+
+    while (pos < end) {
+        uint8_t code = buf[pos];
+        if (code == OPT_PAD) {
+            pos++;
+            continue;
+        }
+        if (code == OPT_END) {
+            return 0;
+        }
+        if (pos + 2 > end || pos + 2 + buf[pos + 1] > end) {
+            return -1;
+        }
+        view->offset[code] = pos + 2;
+        pos += 2 + buf[pos + 1];
+    }
+    return 0;
+}
+
+// Valida la cabecera y construye la tabla de opciones sin copiar el mensaje
+static inline int dhcp_parse(const void *data, size_t len, dhcp_view *view) {
+    const dhcp_packet *pkt = (const dhcp_packet *)data;
+
+    if (len < DHCP_OPTIONS_START || pkt->cookie != htonl(DHCP_MAGIC_COOKIE)) {
+        return -1;
+    }
+    view->buf = (const uint8_t *)data;
+    view->len = len;
+    memset(view->offset, 0, sizeof(view->offset));
+    if (dhcp_walk_options(view, DHCP_OPTIONS_START, len) < 0) {
+        return -1;
+    }
+
+    // Opción 52: las opciones continúan en los campos file y/o sname
+    uint16_t overload = view->offset[OPT_OVERLOAD];
+    if (overload != 0 && view->buf[overload - 1] == 1) {
+        uint8_t fields = view->buf[overload];
+        if ((fields & 1) && dhcp_walk_options(view, offsetof(dhcp_packet, file), offsetof(dhcp_packet, cookie)) < 0) {
+            return -1;
+        }
+        if ((fields & 2) && dhcp_walk_options(view, offsetof(dhcp_packet, sname), offsetof(dhcp_packet, file)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline const dhcp_packet *dhcp_header(const dhcp_view *view) {
+    return (const dhcp_packet *)view->buf;
+}
+
+// Devuelve el valor de una opción (y su longitud) o NULL si no está
+static inline const uint8_t *dhcp_option(const dhcp_view *view, uint8_t code, uint8_t *len) {
+    uint16_t off = view->offset[code];
+    if (off == 0) {
+        return NULL;
+    }
+    if (len != NULL) {
+        *len = view->buf[off - 1];
+    }
+    return view->buf + off;
+}
+
+// Lee una opción de 4 bytes (IPv4 o entero) en orden de red; devuelve 0 si no está
+static inline int dhcp_option_u32(const dhcp_view *view, uint8_t code, uint32_t *value) {
+    uint8_t len;
+    const uint8_t *data = dhcp_option(view, code, &len);
+    if (data == NULL || len != 4) {
+        return 0;
+    }
+    memcpy(value, data, 4);
+    return 1;
+}
+
+static inline int dhcp_message_type(const dhcp_view *view) {
+    uint8_t len;
+    const uint8_t *data = dhcp_option(view, OPT_MESSAGE_TYPE, &len);
+    return (data != NULL && len == 1) ? data[0] : 0;
+}
+
+// MAC Ethernet del cliente como entero de 48 bits (0 si no es Ethernet)
+static inline uint64_t dhcp_client_mac(const dhcp_packet *pkt) {
+    uint64_t mac = 0;
+    if (pkt->htype != 1 || pkt->hlen != 6) {
+        return 0;
+    }
+    for (int i = 0; i < 6; i++) {
+        mac = (mac << 8) | pkt->chaddr[i];
+    }
+    return mac;
+}
+
+static inline void dhcp_set_client_mac(dhcp_packet *pkt, uint64_t mac) {
+    pkt->htype = 1;
+    pkt->hlen = 6;
+    for (int i = 5; i >= 0; i--) {
+        pkt->chaddr[i] = mac & 0xff;
+        mac >>= 8;
+    }
+}
+
+static inline void dhcp_format_mac(uint64_t mac, char *str) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < 6; i++) {
+        uint8_t byte = mac >> (40 - 8 * i);
+        str[i * 3] = hex[byte >> 4];
+        str[i * 3 + 1] = hex[byte & 15];
+        str[i * 3 + 2] = i < 5 ? ':' : '\0';
+    }
+}
+
+// Prepara la cabecera fija de un mensaje saliente; las opciones empiezan en la posición 0
+static inline void dhcp_init_packet(dhcp_packet *pkt, uint8_t op, uint32_t xid, uint64_t mac) {
+    memset(pkt, 0, DHCP_OPTIONS_START);
+    pkt->op = op;
+    pkt->xid = xid;
+    dhcp_set_client_mac(pkt, mac);
+    pkt->cookie = htonl(DHCP_MAGIC_COOKIE);
+}
+
+// Añade una opción en la posición *pos de options; devuelve -1 si no cabe
+static inline int dhcp_put_option(dhcp_packet *pkt, size_t *pos, uint8_t code, uint8_t len, const void *data) {
+    if (*pos + 2 + len + 1 > sizeof(pkt->options)) {
+        return -1;
+    }
+    pkt->options[(*pos)++] = code;
+    pkt->options[(*pos)++] = len;
+    memcpy(&pkt->options[*pos], data, len);
+    *pos += len;
+    return 0;
+}
+
+// Cierra las opciones y devuelve la longitud del mensaje a enviar
+static inline size_t dhcp_finish(dhcp_packet *pkt, size_t pos) {
+    pkt->options[pos++] = OPT_END;
+    size_t len = DHCP_OPTIONS_START + pos;
+    if (len < DHCP_MIN_PACKET) {
+        memset(&pkt->options[pos], 0, DHCP_MIN_PACKET - len);
+        len = DHCP_MIN_PACKET;
+    }
+    return len;
+}
+
+static inline const char *dhcp_type_name(int type) {
+    switch (type) {
+        case DHCPDISCOVER: return "DHCPDISCOVER";
+        case DHCPOFFER: return "DHCPOFFER";
+        case DHCPREQUEST: return "DHCPREQUEST";
+        case DHCPDECLINE: return "DHCPDECLINE";
+        case DHCPACK: return "DHCPACK";
+        case DHCPNAK: return "DHCPNAK";
+        case DHCPRELEASE: return "DHCPRELEASE";
+        case DHCPINFORM: return "DHCPINFORM";
+        case DHCPLEASEQUERY: return "DHCPLEASEQUERY";
+        case DHCPLEASEUNASSIGNED: return "DHCPLEASEUNASSIGNED";
+        case DHCPLEASEUNKNOWN: return "DHCPLEASEUNKNOWN";
+        case DHCPLEASEACTIVE: return "DHCPLEASEACTIVE";
+        default: return "Desconocido";
+    }
+}
+
+#endif
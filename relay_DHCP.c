@@ -2,93 +2,542 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
+#include "codec_DHCP.h"
 
 #define RELAY_PORT 1067           // Puerto donde escucha el relay
-#define SERVER_PORT 67            // Puerto donde escucha el servidor DHCP
-#define CLIENT_PORT 68            // Puerto donde escucha el cliente DHCP
+#define SERVER_PORT DHCP_SERVER_PORT // Puerto donde escucha el servidor DHCP
+#define CLIENT_PORT DHCP_CLIENT_PORT // Puerto donde escucha el cliente DHCP
 #define SERVER_IP "127.0.0.1"     // IP del servidor (localhost para pruebas)
 #define RELAY_IP "127.0.0.1"    // IP del relay en la subred del cliente
+#define DEFAULT_PENDING 65536     // Transacciones en curso como máximo
+#define DEFAULT_TIMEOUT_MS 4000   // Tiempo máximo de espera de la respuesta del servidor
+#define TICK_MS 100               // Resolución de la expiración de transacciones
+#define MAX_UPSTREAMS 16          // Servidores DHCP a los que se puede reenviar
+#define RING_VNODES 64            // Puntos de cada servidor en el anillo de hash consistente
+#define FAIL_THRESHOLD 3          // Timeouts seguidos para dar un servidor por caído
+#define DOWN_MS 5000              // Tiempo que un servidor caído queda fuera del reparto
 
+// Transacción reenviada al servidor que espera respuesta. Se identifica por
+// el par (xid, MAC) para no confundir clientes que eligen el mismo xid.
 typedef struct {
-    int message_type;
-    char client_mac[18];
-    char requested_ip[16];
-    uint8_t options[312];
-    uint32_t giaddr;             // Agregar el campo giaddr
-} dhcp_message;
-
-int main() {
-    int sockfd;
-    struct sockaddr_in client_addr, server_addr, relay_addr;
-    dhcp_message msg;
-    socklen_t addr_len = sizeof(struct sockaddr_in);
-
-    // Crear el socket UDP
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("No se pudo crear el socket");
-        exit(EXIT_FAILURE);
+    uint32_t xid;
+    uint64_t mac;
+    uint64_t deadline_ms;
+    uint64_t sent_us;               // Para medir la latencia del servidor
+    struct sockaddr_in client_addr; // A quién devolver la respuesta
+    uint8_t upstream;               // Servidor al que se reenvió
+    uint8_t used;
+} pending_entry;
+
+// Entrada de la cola de expiración; el timeout es uniforme, así que la cola
+// queda ordenada por plazo sin más trabajo
+typedef struct {
+    uint32_t xid;
+    uint64_t mac;
+    uint64_t deadline_ms;
+} pending_timeout;
+
+// Servidor DHCP de destino con su estado de salud
+typedef struct {
+    struct sockaddr_in addr;
+    char name[24];                // ip:puerto para los mensajes
+    uint64_t latency_us;          // Media móvil exponencial de la latencia
+    uint64_t down_until_ms;       // Fuera del reparto hasta este momento (0 = sano)
+    unsigned consecutive_timeouts;
+    uint64_t forwarded, replied, timeouts;
+} upstream;
+
+// Punto del anillo de hash consistente
+typedef struct {
+    uint32_t point;
+    uint8_t upstream;
+} ring_point;
+
+int client_sock;                 // Socket del lado de los clientes (puerto del relay)
+int server_sock;                 // Socket del lado del servidor (puerto efímero)
+upstream upstreams[MAX_UPSTREAMS];
+int num_upstreams;
+ring_point ring[MAX_UPSTREAMS * RING_VNODES];
+int ring_size;
+uint32_t relay_giaddr;           // IP del relay en la subred del cliente (orden de red)
+
+pending_entry *pending;          // Tabla hash de direccionamiento abierto
+uint32_t pending_mask;
+uint32_t pending_count;
+pending_timeout *timeout_ring;
+uint32_t timeout_head, timeout_tail;
+uint64_t timeout_ms = DEFAULT_TIMEOUT_MS;
+
+uint64_t forwarded, replied, expired, dropped;
+int verbose;                     // -v: una línea por cada paquete reenviado o descartado
+volatile sig_atomic_t running = 1;
+
+uint64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint32_t mix_hash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
+int compare_ring_points(const void *a, const void *b) {
+    uint32_t pa = ((const ring_point *)a)->point, pb = ((const ring_point *)b)->point;
+    return (pa > pb) - (pa < pb);
+}
+
+// Construye el anillo: los puntos dependen de la dirección de cada servidor y no
+// de su posición en la lista, así que añadir o quitar uno solo mueve sus MACs
+void build_ring() {
+    ring_size = 0;
+    for (int u = 0; u < num_upstreams; u++) {
+        uint64_t key = ((uint64_t)upstreams[u].addr.sin_addr.s_addr << 16) | upstreams[u].addr.sin_port;
+        for (int v = 0; v < RING_VNODES; v++) {
+            ring[ring_size++] = (ring_point){mix_hash((key << 8 | v) * 0x9E3779B97F4A7C15ULL), u};
+        }
     }
+    qsort(ring, ring_size, sizeof(ring_point), compare_ring_points);
+}
 
-    // Configurar la dirección del relay para escuchar solicitudes del cliente
-    memset(&relay_addr, 0, sizeof(relay_addr));
-    relay_addr.sin_family = AF_INET;
-    relay_addr.sin_addr.s_addr = inet_addr(RELAY_IP); // IP del relay en la subred del cliente
-    relay_addr.sin_port = htons(RELAY_PORT);
+int upstream_healthy(int u, uint64_t now) {
+    return upstreams[u].down_until_ms <= now;
+}
 
-    // Enlazar el socket del relay al puerto del relay
-    if (bind(sockfd, (struct sockaddr*)&relay_addr, sizeof(relay_addr)) < 0) {
-        perror("No se pudo enlazar el socket del relay");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+// Elige el servidor de una MAC: el primer punto del anillo a partir de su hash
+// cuyo servidor esté sano. Así las renovaciones van siempre al mismo servidor
+// y, si cae, sus clientes se reparten entre los demás.
+int pick_upstream(uint64_t mac, uint64_t now) {
+    uint32_t h = mix_hash(mac);
+    int lo = 0, hi = ring_size;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].point < h) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int k = 0; k < ring_size; k++) {
+        int u = ring[(lo + k) % ring_size].upstream;
+        if (upstream_healthy(u, now)) {
+            return u;
+        }
     }
+    // Todos caídos: se sigue intentando con el servidor natural de la MAC
+    return ring[lo % ring_size].upstream;
+}
 
-    // Configurar la dirección del servidor DHCP
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
+// Anota un timeout del servidor y lo saca del reparto si acumula demasiados
+void upstream_timeout(int u, uint64_t now) {
+    upstream *up = &upstreams[u];
 
-    printf("Relay Agent DHCP iniciado y escuchando en el puerto %d...\n", RELAY_PORT);
+    up->timeouts++;
+    if (++up->consecutive_timeouts >= FAIL_THRESHOLD && upstream_healthy(u, now)) {
+        up->down_until_ms = now + DOWN_MS;
+        // Al volver basta un timeout más para sacarlo otra vez
+        up->consecutive_timeouts = FAIL_THRESHOLD - 1;
+        printf("Servidor %s marcado como caído tras %d timeouts seguidos\n", up->name, FAIL_THRESHOLD);
+    }
+}
 
+void upstream_reply(int u, uint64_t latency_us) {
+    upstream *up = &upstreams[u];
+
+    up->replied++;
+    up->consecutive_timeouts = 0;
+    if (up->down_until_ms != 0) {
+        up->down_until_ms = 0;
+        printf("Servidor %s de nuevo disponible\n", up->name);
+    }
+    // Media móvil con peso 1/8 para la nueva muestra
+    up->latency_us = up->latency_us == 0 ? latency_us : (up->latency_us * 7 + latency_us) / 8;
+}
+
+static inline uint32_t pending_hash(uint32_t xid, uint64_t mac) {
+    uint64_t h = (mac ^ ((uint64_t)xid << 16)) * 0x9E3779B97F4A7C15ULL;
+    return h >> 32;
+}
+
+// Devuelve la posición de la transacción o -1 si no está
+long pending_find(uint32_t xid, uint64_t mac) {
+    for (uint32_t i = pending_hash(xid, mac) & pending_mask; pending[i].used; i = (i + 1) & pending_mask) {
+        if (pending[i].xid == xid && pending[i].mac == mac) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Inserta o refresca una transacción (un cliente que retransmite reutiliza el xid);
+// devuelve -1 si la tabla está llena
+int pending_insert(uint32_t xid, uint64_t mac, const struct sockaddr_in *client_addr, uint64_t deadline, int upstream) {
+    uint32_t i = pending_hash(xid, mac) & pending_mask;
+
+    // Las retransmisiones también ocupan la cola de expiración
+    if (timeout_tail - timeout_head > pending_mask) {
+        return -1;
+    }
+    while (pending[i].used) {
+        if (pending[i].xid == xid && pending[i].mac == mac) {
+            break;
+        }
+        i = (i + 1) & pending_mask;
+    }
+    if (!pending[i].used) {
+        // Se deja siempre un hueco libre para que las búsquedas terminen
+        if (pending_count + 1 > pending_mask) {
+            return -1;
+        }
+        pending_count++;
+    }
+    pending[i] = (pending_entry){xid, mac, deadline, now_us(), *client_addr, upstream, 1};
+
+    timeout_ring[timeout_tail & pending_mask] = (pending_timeout){xid, mac, deadline};
+    timeout_tail++;
+    return 0;
+}
+
+// Borrado con desplazamiento hacia atrás: no deja lápidas que alarguen las búsquedas
+void pending_remove(uint32_t i) {
+    uint32_t j = i;
+
+    pending[i].used = 0;
+    pending_count--;
     while (1) {
-        memset(&msg, 0, sizeof(msg));
+        j = (j + 1) & pending_mask;
+        if (!pending[j].used) {
+            return;
+        }
+        uint32_t home = pending_hash(pending[j].xid, pending[j].mac) & pending_mask;
+        // Se mueve si su posición ideal no está entre el hueco y su posición actual
+        if (((j - home) & pending_mask) >= ((j - i) & pending_mask)) {
+            pending[i] = pending[j];
+            pending[j].used = 0;
+            i = j;
+        }
+    }
+}
+
+// Expira las transacciones cuyo plazo ha vencido sin respuesta del servidor
+void expire_pending(uint64_t now) {
+    while (timeout_head != timeout_tail && timeout_ring[timeout_head & pending_mask].deadline_ms <= now) {
+        pending_timeout *t = &timeout_ring[timeout_head & pending_mask];
+        long i = pending_find(t->xid, t->mac);
+
+        // Si el cliente retransmitió, el plazo de la tabla es más reciente
+        if (i >= 0 && pending[i].deadline_ms == t->deadline_ms) {
+            if (verbose) {
+                char mac_str[18];
+                dhcp_format_mac(t->mac, mac_str);
+                printf("Sin respuesta del servidor %s para %s (xid 0x%08x)\n",
+                       upstreams[pending[i].upstream].name, mac_str, ntohl(t->xid));
+            }
+            upstream_timeout(pending[i].upstream, now);
+            pending_remove(i);
+            expired++;
+        }
+        timeout_head++;
+    }
+}
+
+// Lee todas las solicitudes disponibles del lado de los clientes y las reenvía
+void handle_client_socket() {
+    dhcp_packet msg;
+    dhcp_view view;
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+    char mac_str[18];
+    ssize_t len;
+
+    while ((len = recvfrom(client_sock, &msg, sizeof(msg), 0, (struct sockaddr*)&client_addr, &addr_len)) >= 0) {
+        // Solo se reenvían solicitudes BOOTP bien formadas
+        if (dhcp_parse(&msg, len, &view) < 0 || msg.op != BOOTREQUEST) {
+            if (verbose) {
+                printf("Descartado mensaje mal formado de %s\n", inet_ntoa(client_addr.sin_addr));
+            }
+            dropped++;
+            continue;
+        }
+
+        uint64_t mac = dhcp_client_mac(&msg);
+        int type = dhcp_message_type(&view);
+        if (verbose) {
+            dhcp_format_mac(mac, mac_str);
+            printf("Recibida solicitud %s del cliente %s\n", dhcp_type_name(type), mac_str);
+        }
 
-        // Recibir mensaje del cliente
-        if (recvfrom(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&client_addr, &addr_len) < 0) {
-            perror("Error al recibir mensaje del cliente");
+        // RFC 1542: se descarta si ha atravesado demasiados relays
+        if (++msg.hops > DHCP_MAX_HOPS) {
+            if (verbose) {
+                printf("Descartada solicitud de %s: demasiados saltos\n", mac_str);
+            }
+            dropped++;
             continue;
         }
 
-        printf("Recibida solicitud DHCP del cliente %s\n", msg.client_mac);
+        // Configurar el campo `giaddr` con la IP del relay en la subred del cliente,
+        // salvo que otro relay anterior ya lo haya hecho
+        if (msg.giaddr == 0) {
+            msg.giaddr = relay_giaddr;
+        }
+
+        uint64_t now = now_ms();
+        int u = pick_upstream(mac, now);
 
-        // Configurar el campo `giaddr` con la IP del relay en la subred del cliente
-        inet_pton(AF_INET, RELAY_IP, &msg.giaddr); // Asignar IP del relay
+        // DHCPRELEASE y DHCPDECLINE no tienen respuesta: no ocupan la tabla
+        if (type != DHCPRELEASE && type != DHCPDECLINE &&
+            pending_insert(msg.xid, mac, &client_addr, now + timeout_ms, u) < 0) {
+            if (verbose) {
+                printf("Tabla de transacciones llena, descartada solicitud de %s\n", mac_str);
+            }
+            dropped++;
+            continue;
+        }
 
-        // Reenviar la solicitud al servidor DHCP
-        printf("Reenviando solicitud al servidor DHCP %s:%d\n", SERVER_IP, SERVER_PORT);
-        if (sendto(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&server_addr, addr_len) < 0) {
+        if (sendto(server_sock, &msg, len, 0, (struct sockaddr*)&upstreams[u].addr, sizeof(upstreams[u].addr)) < 0) {
             perror("Error al reenviar mensaje al servidor");
             continue;
         }
+        upstreams[u].forwarded++;
+        forwarded++;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Error al recibir mensaje del cliente");
+    }
+}
+
+// Lee todas las respuestas del servidor y las devuelve al cliente que las pidió
+void handle_server_socket() {
+    dhcp_packet msg;
+    dhcp_view view;
+    char mac_str[18];
+    ssize_t len;
 
-        // Esperar respuesta del servidor
-        if (recvfrom(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&server_addr, &addr_len) < 0) {
-            perror("Error al recibir respuesta del servidor");
+    while ((len = recv(server_sock, &msg, sizeof(msg), 0)) >= 0) {
+        if (dhcp_parse(&msg, len, &view) < 0 || msg.op != BOOTREPLY) {
+            dropped++;
             continue;
         }
 
-        printf("Respuesta recibida del servidor DHCP, reenviando al cliente...\n");
+        uint64_t mac = dhcp_client_mac(&msg);
+        long i = pending_find(msg.xid, mac);
+        if (verbose) {
+            dhcp_format_mac(mac, mac_str);
+        }
+        if (i < 0) {
+            if (verbose) {
+                printf("Respuesta del servidor sin transacción pendiente para %s, descartada\n", mac_str);
+            }
+            dropped++;
+            continue;
+        }
+
+        struct sockaddr_in client_addr = pending[i].client_addr;
+        int u = pending[i].upstream;
+        upstream_reply(u, now_us() - pending[i].sent_us);
+        pending_remove(i);
 
-        // Reenviar la respuesta de vuelta al cliente original
-        if (sendto(sockfd, &msg, sizeof(msg), 0, (struct sockaddr*)&client_addr, addr_len) < 0) {
+        if (verbose) {
+            printf("Respuesta %s del servidor DHCP %s para %s, reenviando al cliente...\n",
+                   dhcp_type_name(dhcp_message_type(&view)), upstreams[u].name, mac_str);
+        }
+        if (sendto(client_sock, &msg, len, 0, (struct sockaddr*)&client_addr, sizeof(client_addr)) < 0) {
             perror("Error al reenviar respuesta al cliente");
             continue;
         }
+        replied++;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("Error al recibir respuesta del servidor");
+    }
+}
+
+void handle_signal(int signum) {
+    (void)signum;
+    running = 0;
+}
+
+// Crea un socket UDP no bloqueante enlazado a la dirección indicada
+int open_socket(const char *ip, int port) {
+    struct sockaddr_in addr;
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) {
+        perror("No se pudo crear el socket");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(ip);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("No se pudo enlazar el socket del relay");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+// Añade un servidor de destino con formato ip[:puerto]
+void add_upstream(const char *spec) {
+    char ip[INET_ADDRSTRLEN];
+    int port = SERVER_PORT;
+    upstream *up = &upstreams[num_upstreams];
+
+    if (num_upstreams == MAX_UPSTREAMS || sscanf(spec, "%15[0-9.]:%d", ip, &port) < 1 || port <= 0 || port > 65535) {
+        fprintf(stderr, "Servidor no válido o demasiados servidores: %s\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    memset(up, 0, sizeof(*up));
+    up->addr.sin_family = AF_INET;
+    up->addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &up->addr.sin_addr) != 1) {
+        fprintf(stderr, "Dirección de servidor no válida: %s\n", spec);
+        exit(EXIT_FAILURE);
+    }
+    snprintf(up->name, sizeof(up->name), "%s:%d", ip, port);
+    num_upstreams++;
+}
+
+void print_upstream_stats() {
+    for (int u = 0; u < num_upstreams; u++) {
+        upstream *up = &upstreams[u];
+        printf("  %-21s %s  reenviadas %llu, respondidas %llu, timeouts %llu, latencia media %llu us\n",
+               up->name, upstream_healthy(u, now_ms()) ? "sano  " : "caído ",
+               (unsigned long long)up->forwarded, (unsigned long long)up->replied,
+               (unsigned long long)up->timeouts, (unsigned long long)up->latency_us);
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-n transacciones_en_curso] [-T timeout_ms] [-v] [servidor[:puerto] ...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t capacity = DEFAULT_PENDING;
+    struct epoll_event ev, events[16];
+    int epfd, timer_fd, opt;
+
+    while ((opt = getopt(argc, argv, "n:T:v")) != -1) {
+        switch (opt) {
+            case 'n': capacity = strtoul(optarg, NULL, 10); break;
+            case 'T': timeout_ms = strtoull(optarg, NULL, 10); break;
+            case 'v': verbose = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (capacity < 2 || timeout_ms == 0) {
+        usage(argv[0]);
+    }
+
+    // Servidores DHCP de destino; sin argumentos, el servidor local de siempre
+    for (int i = optind; i < argc; i++) {
+        add_upstream(argv[i]);
+    }
+    if (num_upstreams == 0) {
+        add_upstream(SERVER_IP);
+    }
+    build_ring();
+
+    // La tabla y la cola de expiración comparten tamaño (potencia de dos)
+    uint32_t size = 2;
+    while (size < capacity && size < (1U << 30)) {
+        size <<= 1;
+    }
+    pending = calloc(size, sizeof(pending_entry));
+    timeout_ring = malloc(size * sizeof(pending_timeout));
+    if (pending == NULL || timeout_ring == NULL) {
+        perror("No se pudo reservar la tabla de transacciones");
+        exit(EXIT_FAILURE);
+    }
+    pending_mask = size - 1;
+
+    // Socket del lado de los clientes en el puerto del relay y socket propio
+    // hacia el servidor, para que sus respuestas no compitan con las solicitudes
+    client_sock = open_socket(RELAY_IP, RELAY_PORT);
+    server_sock = open_socket("0.0.0.0", 0);
+    inet_pton(AF_INET, RELAY_IP, &relay_giaddr);
+
+    // Temporizador periódico para expirar transacciones sin respuesta
+    struct itimerspec tick = {{0, TICK_MS * 1000000L}, {0, TICK_MS * 1000000L}};
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0 ||
+        timerfd_settime(timer_fd, 0, &tick, NULL) < 0) {
+        perror("No se pudo crear el temporizador de transacciones");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        perror("No se pudo crear epoll");
+        exit(EXIT_FAILURE);
+    }
+    int fds[3] = {client_sock, server_sock, timer_fd};
+    for (int i = 0; i < 3; i++) {
+        ev.events = EPOLLIN;
+        ev.data.fd = fds[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            perror("No se pudo registrar el descriptor en epoll");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    printf("Relay Agent DHCP iniciado y escuchando en el puerto %d (%u transacciones en curso, timeout %llu ms, %d servidores)...\n",
+           RELAY_PORT, pending_mask, (unsigned long long)timeout_ms, num_upstreams);
+
+    while (running) {
+        int n = epoll_wait(epfd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error en epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == client_sock) {
+                handle_client_socket();
+            } else if (events[i].data.fd == server_sock) {
+                handle_server_socket();
+            } else {
+                uint64_t ticks;
+                if (read(timer_fd, &ticks, sizeof(ticks)) > 0) {
+                    expire_pending(now_ms());
+                }
+            }
+        }
     }
 
-    close(sockfd);
+    printf("Relay: %llu solicitudes reenviadas, %llu respuestas devueltas, %llu expiradas, %llu descartadas\n",
+           (unsigned long long)forwarded, (unsigned long long)replied,
+           (unsigned long long)expired, (unsigned long long)dropped);
+    print_upstream_stats();
+    close(epfd);
+    close(timer_fd);
+    close(client_sock);
+    close(server_sock);
     return 0;
 }
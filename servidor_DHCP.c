@@ -1,5 +1,9 @@
+#define _GNU_SOURCE         // recvmmsg/sendmmsg
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -8,246 +12,4436 @@
 #include <pthread.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <sys/timerfd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include "codec_DHCP.h"
 
-#define PORT 67             // Puerto estándar del servidor DHCP
+#define PORT DHCP_SERVER_PORT // Puerto estándar del servidor DHCP
+#define SERVER_IDENTIFIER "192.168.1.1" // Identificador del servidor (opción 54) por defecto
 #define SUBNET_MASK "255.255.255.0"
 #define DEFAULT_GATEWAY "192.168.1.1"
 #define DNS_SERVER "8.8.8.8"
 #define DOMAIN_NAME "example.local"
+#define NTP_SERVERS ""      // Servidores NTP separados por comas (vacío = no se envía la opción 42)
+#define CLASSLESS_ROUTES "" // Rutas "red/prefijo:puerta,..." (vacío = no se envía la opción 121)
+#define OPTIONS_SIZE 312
 #define LEASE_TIME 120      // Tiempo de concesión (lease)
-#define MAX_THREADS 5       // Número máximo de hilos activos
+#define OFFER_TIME 30       // Reserva de una IP ofrecida a la espera de su DHCPREQUEST
+#define DEFAULT_WORKERS 4   // Hilos trabajadores por defecto
+#define DEFAULT_QUEUE 1024  // Mensajes preasignados en la cola por defecto
+#define DEFAULT_BATCH 32   // Datagramas por llamada en el modo por lotes
+#define MAX_BATCH 256
+#define CACHE_LINE 64
+#define DEFAULT_JOURNAL "leases"  // Prefijo de los ficheros de persistencia (.snap y .journal)
+#define JOURNAL_MAGIC 0x4c484344    // "DHCL"
+#define SNAPSHOT_MAGIC 0x53484344   // "DHCS"
+#define COMMIT_WINDOW_US 2000       // Ventana de agrupación de escrituras antes de cada fsync
+#define BITMAP_MAX_LEVELS 6 // 64^6 bits, suficiente para cualquier rango IPv4
+#define WHEEL_BITS 6        // Ranuras por nivel de la rueda de temporizadores (2^6)
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4      // Alcance de 64^4 segundos (~194 días)
+#define DEFAULT_STATS "dhcp_stats.sock"  // Socket UNIX de estadísticas
+#define MAX_METRIC_THREADS 256
+#define METRIC_TYPES 14     // Tipos de mensaje DHCP 1..13 más desconocido
+#define HIST_SUB_BITS 5     // 32 subcubos por potencia de dos
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+#define LOG_RING_SIZE 4096  // Registros por hilo pendientes de escribir (potencia de dos)
+#define LOG_MAX_ARGS 6
+#define LOG_BATCH 4096      // Registros que el escritor ordena y escribe de una vez
+#define LOG_LINE_MAX 256
+#define MAC_INDEX_PARTS 64  // Subtablas del índice de MACs, cada una con su cerrojo de escritura
+#define MAX_EPOCH_THREADS 256  // Hilos que pueden leer la configuración a la vez
+#define DEFAULT_RATE 10     // Mensajes por segundo y MAC (0 = sin límite)
+#define DEFAULT_BURST 20    // Ráfaga máxima por MAC
+#define RATE_TABLE_BITS 16  // Cubetas de la tabla de límites por MAC (2^16)
+#define RATE_SCALE 256      // Las fichas se cuentan en 1/256
+#define URING_ENTRIES 256   // Entradas de la cola de envío de cada anillo io_uring
+#define URING_BUFFERS 1024  // Búferes de recepción registrados por anillo (potencia de dos)
+#define URING_BUF_SIZE 2048 // Cabecera de recvmsg + dirección + datagrama
+#define URING_SEND_SLOTS 256 // Respuestas en vuelo por anillo
+#define URING_BGID 0        // Grupo de los búferes de recepción
+#define RESERVATION_GROUP 4 // Reservas por grupo (y por semilla) del hash perfecto
+#define RESERVATION_MAX_GROUP 32  // Un grupo mayor obliga a cambiar la semilla global
+#define RESERVATION_MAX_TRIES (1u << 24)  // Semillas que se prueban por grupo
+#define REPLICA_PORT 647    // Puerto UDP de replicación del par HA (el de failover DHCP)
+#define REPLICA_MAGIC 0x52484344  // "DHCR"
+#define REPLICA_BATCH 40    // Registros por datagrama de replicación (< 1400 bytes)
+#define REPLICA_WINDOW 64   // Lotes enviados pendientes de confirmación
+#define REPLICA_DELAY_US 1000     // Ventana de agrupación de cambios antes de enviarlos
+#define REPLICA_RETRY_MS 200      // Reenvío de los lotes sin confirmar
+#define REPLICA_HEARTBEAT_MS 1000 // Confirmación periódica aunque no haya cambios
+#define REPLICA_PEER_TIMEOUT 3    // Segundos sin noticias para dar por caído al otro servidor
+#define LEASEQUERY_MAX_IPS 16     // IPs de una misma MAC en la respuesta a DHCPLEASEQUERY
 
+// Bloque de opciones precompilado: se codifica una vez al arrancar y cada respuesta
+// es una copia más el parche del tipo de mensaje y del tiempo de concesión
 typedef struct {
-    int message_type;
-    char client_mac[18];
-    char requested_ip[16];
-    uint8_t options[312];
-} dhcp_message;
+    uint8_t bytes[OPTIONS_SIZE];
+    int length;
+    int type_offset;             // Posición del valor de la opción 53
+    int lease_offset;            // Posición del valor de la opción 51
+} option_template;
+
+// Estado de una entrada del pool. Una IP ofrecida queda reservada poco tiempo y
+// solo pasa a asignada (lease completo) con el DHCPREQUEST del cliente.
+// Titular, estado y expiración se modifican bajo la secuencia de la entrada (seqlock):
+// las consultas los copian sin cerrojos y repiten la copia si la secuencia cambió
+enum { ENTRY_LIBRE, ENTRY_ASIGNADA, ENTRY_OFRECIDA };
 
 typedef struct {
     unsigned int ip_addr;
-    int is_assigned;
+    atomic_uint seq;              // Impar mientras un escritor modifica la entrada
+    atomic_int state;             // ENTRY_LIBRE, ENTRY_ASIGNADA o ENTRY_OFRECIDA
+    _Atomic uint64_t client_mac;  // MAC binaria del titular (0 = ninguno)
     time_t lease_expiration; // Control de expiración del lease
+    int timer_next;          // Enlaces de la lista de la ranura de la rueda (-1 = ninguno)
+    int timer_prev;
+    int timer_slot;          // Ranura donde está programada (-1 = no programada)
+    int shard;               // Partición a la que pertenece
 } ip_entry;
 
-typedef struct {
-    int sockfd;
-    dhcp_message *msg;
-    struct sockaddr_in client_addr;
-} client_data;
+// Bitmap jerárquico de IPs libres. En el nivel 0 cada bit es una IP (1 = libre);
+// en los niveles superiores cada bit indica que la palabra hija tiene algún bit libre.
+// Asignar y liberar recorren un camino raíz-hoja: O(log64 n), constante en la práctica.
+typedef struct {
+    int levels;
+    _Atomic uint64_t *words[BITMAP_MAX_LEVELS];
+    size_t nwords[BITMAP_MAX_LEVELS];
+} ip_bitmap;
+
+typedef struct {
+    int sockfd;
+    size_t len;                  // Bytes recibidos en msg
+    uint64_t rx_ns;              // Momento de la recepción (reloj monótono)
+    dhcp_packet msg;
+    struct sockaddr_in client_addr;
+} client_data;
+
+// Celda de la cola MPMC acotada (algoritmo de Vyukov): la secuencia indica
+// si la celda está libre para el productor o lista para el consumidor
+typedef struct {
+    atomic_size_t seq;
+    unsigned int slot;
+} ring_cell;
+
+typedef struct {
+    ring_cell *cells;
+    size_t mask;
+    char pad0[CACHE_LINE];
+    atomic_size_t head;          // Posición de escritura
+    char pad1[CACHE_LINE];
+    atomic_size_t tail;          // Posición de lectura
+    char pad2[CACHE_LINE];
+} mpmc_ring;
+
+// Rueda jerárquica de temporizadores para la expiración de leases. Cada nivel
+// cubre 64 veces el alcance del anterior; las entradas bajan de nivel al
+// acercarse su expiración, por lo que avanzar un segundo solo toca las que vencen.
+struct pool_config;
+
+typedef struct {
+    pthread_mutex_t lock;
+    time_t now;                  // Último segundo procesado
+    int heads[WHEEL_LEVELS * WHEEL_SIZE];
+    struct pool_config *config;  // Configuración cuyas entradas enlaza
+} lease_wheel;
+
+// Índice MAC -> entrada del pool con direccionamiento abierto y sondeo lineal, repartido
+// en subtablas por el hash de la MAC. Cada cubeta guarda una etiqueta del hash y el
+// índice de la entrada; la entrada se verifica contra su MAC titular, así que las
+// lecturas no necesitan cerrojos. Las escrituras de una subtabla se serializan con su
+// cerrojo y los borrados desplazan las cubetas siguientes hacia atrás en lugar de dejar
+// lápidas, de modo que una MAC desconocida siempre termina en un hueco cercano.
+typedef struct {
+    _Atomic uint64_t *buckets;
+    size_t mask;
+    atomic_uint version;         // Impar mientras un borrado desplaza cubetas
+    pthread_mutex_t lock;        // Inserciones y borrados de la subtabla
+} __attribute__((aligned(CACHE_LINE))) mac_index_part;
+
+typedef struct {
+    mac_index_part parts[MAC_INDEX_PARTS];
+    ip_entry *entries;           // Pool al que apuntan las cubetas
+} mac_index;
+
+// Partición de un ámbito. En el modo normal cada ámbito tiene una sola; en el modo
+// fragmentado el hilo k posee la partición k de cada ámbito (bitmap y rueda propios)
+// y solo toca las ajenas al quedarse sin IPs
+typedef struct {
+    long first;                  // Primer índice del pool que cubre
+    long count;
+    int part;                    // Número de partición dentro del ámbito (= hilo propietario)
+    ip_bitmap free_map;          // IPs libres de la partición (bit = índice - first)
+    lease_wheel timers;          // Expiraciones programadas de la partición
+    char pad[CACHE_LINE];
+} pool_shard;
+
+int num_parts = 1;               // Particiones por ámbito (hilos en modo fragmentado)
+static __thread int home_shard;  // Número de la partición propia del hilo en cada ámbito
+
+// Ámbito (subred) servido: red, rango dinámico, tramo del pool y opciones propias
+typedef struct {
+    uint32_t network;            // Orden de host
+    int prefix_len;
+    uint32_t range_start;        // Rango de IPs dinámicas (orden de host)
+    uint32_t range_end;
+    long first;                  // Primer índice del ámbito en ip_pool
+    long count;
+    int first_shard;             // Sus particiones en shards[]
+    int parts;
+    int lease_time;
+    option_template options;     // Bloque de opciones precompilado del ámbito
+} dhcp_scope;
+
+// Árbol binario de prefijos para elegir el ámbito por coincidencia más larga:
+// la búsqueda recorre como mucho 32 nodos sea cual sea el número de ámbitos
+typedef struct {
+    int child[2];                // Índices de los hijos (-1 = ninguno)
+    int scope;                   // Ámbito cuyo prefijo termina aquí (-1 = ninguno)
+} lpm_node;
+
+typedef struct {
+    lpm_node *nodes;
+    int count;
+    int capacity;
+} lpm_trie;
+
+// Rango de direcciones que no se asigna nunca (orden de host)
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+} ip_range;
+
+// Reservas estáticas MAC -> IP en un hash perfecto mínimo: la MAC elige un grupo y la
+// semilla del grupo la lleva a una posición propia de la tabla, sin colisiones ni huecos.
+// Buscar cuesta dos hashes y una comparación; ocupa 12 bytes por reserva más 4 por grupo,
+// y 4 más por reserva para el índice inverso por IP de DHCPLEASEQUERY.
+typedef struct {
+    uint64_t *keys;              // MAC | ámbito de la IP << 48, en la posición de la MAC
+    uint32_t *ips;               // IP reservada (orden de host)
+    uint32_t *seeds;             // Semilla de cada grupo
+    uint32_t *by_ip;             // Posiciones ordenadas por IP, para buscar por dirección
+    size_t count;
+    size_t capacity;
+    size_t nbuckets;
+    uint64_t salt;               // Semilla global con la que se compiló
+} reservation_table;
+
+// Configuración completa: ámbitos, pool, particiones e índice de leases. Al recargar se
+// construye otra aparte y se publica con un único almacenamiento atómico; los hilos la
+// leen dentro de una sección de época y la anterior se libera cuando ya nadie la usa.
+typedef struct pool_config {
+    dhcp_scope *scopes;
+    int num_scopes;
+    int scope_capacity;
+    lpm_trie trie;
+    int default_scope;           // Ámbito para direcciones que no coinciden con ninguno (-1 = ninguno)
+    ip_range *exclusions;
+    int num_exclusions;
+    int exclusion_capacity;
+    long excluded;               // Direcciones del pool retiradas por exclusiones
+    ip_entry *ip_pool;           // Entradas de todos los ámbitos, cada uno en un tramo contiguo
+    int pool_size;
+    pool_shard *shards;          // Particiones de todos los ámbitos
+    int num_shards;
+    mac_index lease_index;       // Leases activos por MAC del cliente
+    reservation_table reservations;
+    unsigned long generation;
+} pool_config;
+
+_Atomic(pool_config *) active_config;
+
+// Épocas de lectura: al entrar, cada hilo anuncia en su ranura la época global (0 =
+// fuera). Quien publica una configuración nueva avanza la época y espera a que ninguna
+// ranura siga en una anterior; los lectores nunca esperan.
+typedef struct {
+    _Atomic uint64_t epoch;
+} __attribute__((aligned(CACHE_LINE))) epoch_slot;
+
+epoch_slot epoch_slots[MAX_EPOCH_THREADS];
+atomic_int epoch_threads;
+_Atomic uint64_t global_epoch = 1;
+static __thread epoch_slot *epoch_self;
+
+// Registro binario del diario de leases: estado completo de una entrada en un instante,
+// por lo que reaplicarlo es idempotente. El campo check detecta colas rotas tras un fallo.
+typedef struct {
+    uint32_t magic;
+    uint32_t ip;                 // Orden de host
+    uint64_t mac;
+    int64_t expires;
+    uint32_t op;                 // 1 = vinculada, 0 = libre
+    uint32_t check;
+} lease_record;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;              // Registros que siguen a la cabecera
+    int64_t created;
+} snapshot_header;
+
+// Diario de leases: los trabajadores solo encolan la IP de la entrada modificada;
+// un hilo escritor lee el estado actual, lo añade al diario y hace fsync por grupos
+typedef struct {
+    int enabled;
+    int fd;
+    char snap_path[256];
+    char journal_path[256];
+    mpmc_ring pending;           // IPs (orden de host) de entradas modificadas
+    atomic_int overflow;         // La cola se llenó: la próxima escritura es una instantánea
+    atomic_int sleeping;         // El escritor espera en el semáforo
+    sem_t wake;
+    long records;                // Registros en el diario desde la última instantánea
+    pthread_t thread;
+} lease_journal;
+
+lease_journal journal;
+
+// Par de alta disponibilidad (-P). Cada servidor es dueño de la mitad del pool (las IPs
+// pares o las impares, según su rol) y solo ofrece direcciones de la suya; el otro
+// recibe los cambios de los leases para renovarlos y servirlos si el primero cae.
+// Como en el diario, los trabajadores solo encolan la IP modificada y un hilo aparte
+// agrupa los registros en lotes numerados que el otro servidor confirma.
+enum { REPLICA_UPDATE = 1, REPLICA_RESET, REPLICA_ACK };
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;               // REPLICA_UPDATE, REPLICA_RESET (inicio de un estado completo) o REPLICA_ACK
+    uint16_t count;              // Registros que siguen a la cabecera
+    uint64_t session;            // Arranque del emisor (en un ACK, el de los lotes confirmados)
+    uint64_t seq;                // Número del lote (en un ACK, el último aplicado en orden)
+} replica_header;
+
+// Los registros van en el formato del diario: los dos servidores son el mismo programa
+typedef struct {
+    replica_header header;
+    lease_record records[REPLICA_BATCH];
+} replica_batch;
+
+typedef struct {
+    int enabled;
+    int role;                    // 0 = IPs pares, 1 = IPs impares
+    int sockfd;
+    struct sockaddr_in peer;
+    mpmc_ring pending;           // IPs (orden de host) modificadas pendientes de enviar
+    atomic_int overflow;         // La cola se llenó: hay que enviar el estado completo
+    atomic_int sleeping;         // El hilo de replicación espera en poll
+    int wake_fd;                 // eventfd que lo despierta
+    _Atomic time_t peer_seen;    // Último datagrama válido del otro servidor
+    uint64_t session;            // Identificador de este arranque
+    uint64_t next_seq;           // Próximo lote a enviar
+    uint64_t acked;              // Último lote confirmado
+    uint64_t reset_seq;          // Lote que inicia el último estado completo
+    long resync;                 // Siguiente entrada del estado completo (-1 = ninguno en curso)
+    unsigned long resync_generation;
+    uint64_t retry_ns;           // Último envío o avance de la ventana
+    uint64_t ack_ns;             // Última confirmación enviada
+    uint64_t peer_session;       // Arranque del otro servidor cuyos lotes se aplican
+    uint64_t expected;           // Próximo lote suyo que se aplica
+    replica_batch window[REPLICA_WINDOW];  // Lotes sin confirmar, en seq % REPLICA_WINDOW
+    _Atomic uint64_t records_sent, records_applied, retransmits, resyncs;
+    pthread_t thread;
+} ha_pair;
+
+ha_pair ha;
+struct in_addr listen_addr = { INADDR_ANY };  // Dirección local de los sockets (-a)
+uint32_t server_id;              // Identificador del servidor en orden de red
+
+client_data *msg_slots;          // Mensajes preasignados, reutilizados por los trabajadores
+mpmc_ring free_ring;             // Índices de mensajes libres
+// Clases de prioridad de la cola de trabajo: los mensajes que continúan o cierran
+// un lease se atienden antes que los que empiezan uno nuevo
+enum { PRIO_ALTA, PRIO_BAJA, PRIO_CLASES };
+
+mpmc_ring work_ring[PRIO_CLASES]; // Índices de mensajes pendientes de procesar, por clase
+unsigned int spare_slot;         // Mensaje reservado al receptor para clasificar con la cola llena
+sem_t work_sem;                  // Cuenta los mensajes pendientes para despertar trabajadores
+volatile sig_atomic_t running = 1;
+int offer_time = OFFER_TIME;     // Segundos de reserva de una oferta (-o)
+
+// Modos de E/S del servidor
+enum { IO_CLASSIC, IO_BATCH, IO_URING };
+int io_mode = IO_CLASSIC;
+int batch_size = DEFAULT_BATCH;
+
+// Lote de respuestas pendientes de un trabajador, enviado con sendmmsg
+typedef struct {
+    int sockfd;
+    int count;
+    struct mmsghdr hdrs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    struct sockaddr_in addrs[MAX_BATCH];
+    uint64_t rx_ns[MAX_BATCH];   // Recepción de la solicitud de cada respuesta
+    dhcp_packet msgs[MAX_BATCH];
+} reply_batch;
+
+static __thread reply_batch *tx_batch;  // Lote del hilo actual (NULL = envío inmediato)
+
+// Métricas por hilo. Cada hilo escribe solo en su bloque (alineado a línea de
+// caché), con cargas y almacenamientos relajados, sin instrucciones atómicas
+// de lectura-modificación-escritura ni líneas compartidas; el lector suma los
+// bloques de todos los hilos al consultar.
+typedef struct {
+    _Atomic uint64_t rx_type[METRIC_TYPES];   // Solicitudes por tipo (0 = desconocido)
+    _Atomic uint64_t tx_type[METRIC_TYPES];   // Respuestas por tipo
+    _Atomic uint64_t malformed;               // Mensajes mal formados descartados
+    _Atomic uint64_t dropped;                 // Paquetes descartados por cola llena
+    _Atomic uint64_t shed[PRIO_CLASES];       // Los mismos por clase (incluye los desalojados)
+    _Atomic uint64_t evicted;                 // DHCPDISCOVER en cola sustituidos por una renovación
+    _Atomic uint64_t rate_limited;            // Mensajes por encima del límite de su MAC
+    _Atomic uint64_t pool_exhausted;          // DHCPDISCOVER sin IPs disponibles
+    _Atomic uint64_t no_scope;                // Solicitudes sin ámbito que las sirva
+    _Atomic uint64_t expired;                 // Leases vencidos liberados por la rueda
+    _Atomic int64_t leased;                   // Variación de leases activos (la suma es el total)
+    _Atomic int64_t offered;                  // Variación de ofertas pendientes
+    _Atomic uint64_t offers_expired;          // Ofertas sin DHCPREQUEST devueltas al pool
+    _Atomic uint64_t deferred;                // DHCPDISCOVER que atiende el otro servidor del par
+    _Atomic uint64_t rx_calls, rx_packets, tx_calls, tx_packets;
+    _Atomic uint64_t latency_max_ns;
+    _Atomic uint64_t latency[HIST_BUCKETS];   // Histograma de recepción a envío, en ns
+} __attribute__((aligned(CACHE_LINE))) thread_metrics;
+
+thread_metrics *metrics_registry[MAX_METRIC_THREADS];
+atomic_int metrics_threads;
+thread_metrics overflow_metrics;  // Compartido solo si se supera MAX_METRIC_THREADS
+static __thread thread_metrics *my_metrics;
+static __thread uint64_t request_rx_ns;  // Recepción de la solicitud en curso
+time_t server_started;
+
+// Bloque de métricas del hilo actual; se registra la primera vez que se usa
+static thread_metrics *metrics(void) {
+    if (__builtin_expect(my_metrics == NULL, 0)) {
+        int n = atomic_fetch_add(&metrics_threads, 1);
+        thread_metrics *m = NULL;
+        if (n < MAX_METRIC_THREADS) {
+            m = aligned_alloc(CACHE_LINE, sizeof(thread_metrics));
+        }
+        if (m == NULL) {
+            my_metrics = &overflow_metrics;
+            return my_metrics;
+        }
+        memset(m, 0, sizeof(*m));
+        metrics_registry[n] = m;
+        my_metrics = m;
+    }
+    return my_metrics;
+}
+
+// Solo escribe el hilo propietario: basta una carga y un almacenamiento relajados
+static inline void metric_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metric_gauge(_Atomic int64_t *gauge, int64_t delta) {
+    atomic_store_explicit(gauge, atomic_load_explicit(gauge, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+static inline void metric_leased(int64_t delta) {
+    metric_gauge(&metrics()->leased, delta);
+}
+
+static inline void metric_offered(int64_t delta) {
+    metric_gauge(&metrics()->offered, delta);
+}
+
+// Entra en una sección de lectura y devuelve la configuración activa, que no se
+// libera hasta config_exit(). Solo cuesta dos accesos a memoria de la propia ranura.
+static pool_config *config_enter(void) {
+    if (epoch_self == NULL) {
+        int k = atomic_fetch_add(&epoch_threads, 1);
+        if (k >= MAX_EPOCH_THREADS) {
+            fprintf(stderr, "Demasiados hilos para las épocas de configuración (máximo %d)\n", MAX_EPOCH_THREADS);
+            exit(EXIT_FAILURE);
+        }
+        epoch_self = &epoch_slots[k];
+    }
+    // El anuncio debe ser visible antes de leer el puntero (orden secuencial en ambos)
+    atomic_store(&epoch_self->epoch, atomic_load(&global_epoch));
+    return atomic_load(&active_config);
+}
+
+static inline void config_exit(void) {
+    atomic_store_explicit(&epoch_self->epoch, 0, memory_order_release);
+}
+
+// Espera a que todos los lectores que pudieran ver la configuración anterior salgan
+static void epoch_synchronize(void) {
+    uint64_t target = atomic_fetch_add(&global_epoch, 1) + 1;
+    int n = atomic_load(&epoch_threads);
+    struct timespec pause = { 0, 50000 };
+
+    for (int k = 0; k < n && k < MAX_EPOCH_THREADS; k++) {
+        uint64_t seen;
+        while ((seen = atomic_load(&epoch_slots[k].epoch)) != 0 && seen < target) {
+            nanosleep(&pause, NULL);
+        }
+    }
+}
+
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Histograma log-lineal al estilo HDR: 2^HIST_SUB_BITS cubos por potencia de
+// dos, con error relativo acotado (~3%) desde nanosegundos hasta segundos
+static inline int hist_bucket(uint64_t value) {
+    if (value < (1 << HIST_SUB_BITS)) {
+        return value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (value >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+static uint64_t hist_bucket_value(int bucket) {
+    if (bucket < (1 << HIST_SUB_BITS)) {
+        return bucket;
+    }
+    int exp = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    int sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+    return (1ULL << exp) | ((uint64_t)sub << (exp - HIST_SUB_BITS));
+}
+
+// Anota la latencia desde la recepción de una solicitud hasta su envío
+static inline void record_latency(uint64_t rx_ns, uint64_t now) {
+    thread_metrics *m = metrics();
+    uint64_t value = now - rx_ns;
+    metric_add(&m->latency[hist_bucket(value)], 1);
+    if (value > atomic_load_explicit(&m->latency_max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&m->latency_max_ns, value, memory_order_relaxed);
+    }
+}
+
+// Suma de todos los hilos (solo para lectura)
+typedef struct {
+    uint64_t rx_type[METRIC_TYPES], tx_type[METRIC_TYPES];
+    uint64_t malformed, dropped, pool_exhausted, no_scope, expired;
+    uint64_t shed[PRIO_CLASES], evicted, rate_limited;
+    int64_t leased, offered;
+    uint64_t offers_expired, deferred;
+    uint64_t rx_calls, rx_packets, tx_calls, tx_packets;
+    uint64_t latency_max_ns, latency_count;
+    uint64_t latency[HIST_BUCKETS];
+} metrics_totals;
+
+static void metrics_collect(metrics_totals *t) {
+    int n = atomic_load(&metrics_threads);
+    if (n > MAX_METRIC_THREADS) {
+        n = MAX_METRIC_THREADS;
+    }
+
+    memset(t, 0, sizeof(*t));
+    for (int k = 0; k <= n; k++) {
+        thread_metrics *m = k < n ? metrics_registry[k] : &overflow_metrics;
+        if (m == NULL) {
+            continue;  // Registro en curso
+        }
+        for (int j = 0; j < METRIC_TYPES; j++) {
+            t->rx_type[j] += atomic_load_explicit(&m->rx_type[j], memory_order_relaxed);
+            t->tx_type[j] += atomic_load_explicit(&m->tx_type[j], memory_order_relaxed);
+        }
+        t->malformed += atomic_load_explicit(&m->malformed, memory_order_relaxed);
+        t->dropped += atomic_load_explicit(&m->dropped, memory_order_relaxed);
+        for (int c = 0; c < PRIO_CLASES; c++) {
+            t->shed[c] += atomic_load_explicit(&m->shed[c], memory_order_relaxed);
+        }
+        t->evicted += atomic_load_explicit(&m->evicted, memory_order_relaxed);
+        t->rate_limited += atomic_load_explicit(&m->rate_limited, memory_order_relaxed);
+        t->pool_exhausted += atomic_load_explicit(&m->pool_exhausted, memory_order_relaxed);
+        t->no_scope += atomic_load_explicit(&m->no_scope, memory_order_relaxed);
+        t->expired += atomic_load_explicit(&m->expired, memory_order_relaxed);
+        t->leased += atomic_load_explicit(&m->leased, memory_order_relaxed);
+        t->offered += atomic_load_explicit(&m->offered, memory_order_relaxed);
+        t->offers_expired += atomic_load_explicit(&m->offers_expired, memory_order_relaxed);
+        t->deferred += atomic_load_explicit(&m->deferred, memory_order_relaxed);
+        t->rx_calls += atomic_load_explicit(&m->rx_calls, memory_order_relaxed);
+        t->rx_packets += atomic_load_explicit(&m->rx_packets, memory_order_relaxed);
+        t->tx_calls += atomic_load_explicit(&m->tx_calls, memory_order_relaxed);
+        t->tx_packets += atomic_load_explicit(&m->tx_packets, memory_order_relaxed);
+        uint64_t max = atomic_load_explicit(&m->latency_max_ns, memory_order_relaxed);
+        if (max > t->latency_max_ns) {
+            t->latency_max_ns = max;
+        }
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            uint64_t c = atomic_load_explicit(&m->latency[b], memory_order_relaxed);
+            t->latency[b] += c;
+            t->latency_count += c;
+        }
+    }
+}
+
+static uint64_t totals_percentile(const metrics_totals *t, double percentile) {
+    uint64_t target = (uint64_t)(t->latency_count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += t->latency[b];
+        if (seen > target) {
+            return hist_bucket_value(b);
+        }
+    }
+    return t->latency_max_ns;
+}
+
+// Registro asíncrono. Cada hilo escribe registros binarios (formato, marca de
+// tiempo y argumentos sin formatear) en su propio anillo productor-consumidor;
+// un hilo aparte los ordena por tiempo, les da formato y los escribe por lotes.
+// El formato admite las conversiones de printf más %M (MAC de 48 bits) y %I
+// (IPv4 en orden de host). Las cadenas %s deben vivir mientras dure el programa.
+enum { LOG_ERROR, LOG_WARN, LOG_INFO, LOG_DEBUG };
+
+typedef struct {
+    uint64_t ts_ns;              // Reloj de tiempo real
+    const char *fmt;
+    int level;
+    uint64_t args[LOG_MAX_ARGS];
+} log_record;
+
+typedef struct {
+    atomic_size_t head;          // Escribe el hilo propietario
+    char pad0[CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t tail;          // Escribe el hilo del registro
+    _Atomic uint64_t lost;       // Registros descartados con el anillo lleno
+    char pad1[CACHE_LINE - sizeof(atomic_size_t) - sizeof(uint64_t)];
+    log_record records[LOG_RING_SIZE];
+} log_ring;
+
+int log_level = LOG_INFO;        // Los mensajes de nivel superior no se registran
+log_ring *log_rings[MAX_METRIC_THREADS];
+atomic_int log_ring_count;
+static __thread log_ring *my_log_ring;
+atomic_int log_sleeping;         // El escritor espera en el semáforo
+atomic_int log_stopping;
+sem_t log_wake;
+pthread_t log_thread_id;
+int log_started;
+
+// El nivel se comprueba antes de evaluar nada: un mensaje filtrado cuesta una comparación
+#define LOG(level, ...) do { if ((level) <= log_level) log_write((level), __VA_ARGS__); } while (0)
+
+static log_ring *log_ring_self(void) {
+    if (__builtin_expect(my_log_ring == NULL, 0)) {
+        int n = atomic_load(&log_ring_count);
+        log_ring *ring = NULL;
+        if (n < MAX_METRIC_THREADS) {
+            ring = aligned_alloc(CACHE_LINE, sizeof(log_ring));
+        }
+        if (ring == NULL) {
+            return NULL;
+        }
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->lost, 0);
+        n = atomic_fetch_add(&log_ring_count, 1);
+        if (n >= MAX_METRIC_THREADS) {
+            free(ring);
+            return NULL;
+        }
+        log_rings[n] = ring;
+        my_log_ring = ring;
+    }
+    return my_log_ring;
+}
+
+// Salta una especificación de conversión a partir del carácter tras '%';
+// devuelve la conversión y deja en *wide si lleva modificador l, ll o z
+static const char *log_spec(const char *p, int *wide) {
+    *wide = 0;
+    while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+        p++;
+    }
+    while (*p == 'l' || *p == 'z' || *p == 'h') {
+        if (*p != 'h') {
+            *wide = 1;
+        }
+        p++;
+    }
+    return p;
+}
+
+// Da formato a un registro en buf; devuelve los bytes escritos
+static size_t log_format(const log_record *rec, char *buf, size_t size) {
+    static const char *level_names[] = {"ERROR", "AVISO", "INFO ", "DEPUR"};
+    time_t secs = rec->ts_ns / 1000000000ULL;
+    struct tm tm;
+    size_t len;
+    int n = 0, wide;
+
+    localtime_r(&secs, &tm);
+    len = snprintf(buf, size, "%02d:%02d:%02d.%03d %s ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+                   (int)(rec->ts_ns / 1000000 % 1000), level_names[rec->level]);
+
+    for (const char *p = rec->fmt; *p != '\0' && len < size - 1; p++) {
+        if (*p != '%') {
+            buf[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            buf[len++] = '%';
+            p++;
+            continue;
+        }
+
+        // Se reconstruye la especificación con el tipo ancho equivalente
+        const char *start = p;
+        const char *conv = log_spec(p + 1, &wide);
+        char spec[32];
+        int flags = conv - start;
+        while (flags > 0 && (start[flags - 1] == 'l' || start[flags - 1] == 'z' || start[flags - 1] == 'h')) {
+            flags--;
+        }
+        if (flags > 20 || *conv == '\0' || n >= LOG_MAX_ARGS) {
+            break;
+        }
+        memcpy(spec, start, flags);
+        uint64_t arg = rec->args[n++];
+        int written = 0;
+        char text[INET_ADDRSTRLEN > 18 ? INET_ADDRSTRLEN : 18];
+
+        switch (*conv) {
+            case 'd': case 'i':
+                strcpy(spec + flags, "lld");
+                written = snprintf(buf + len, size - len, spec, (long long)arg);
+                break;
+            case 'u': case 'x':
+                spec[flags] = 'l';
+                spec[flags + 1] = 'l';
+                spec[flags + 2] = *conv;
+                spec[flags + 3] = '\0';
+                written = snprintf(buf + len, size - len, spec, (unsigned long long)arg);
+                break;
+            case 'c':
+                strcpy(spec + flags, "c");
+                written = snprintf(buf + len, size - len, spec, (int)arg);
+                break;
+            case 'f': {
+                double value;
+                memcpy(&value, &arg, sizeof(value));
+                strcpy(spec + flags, "f");
+                written = snprintf(buf + len, size - len, spec, value);
+                break;
+            }
+            case 's':
+                strcpy(spec + flags, "s");
+                written = snprintf(buf + len, size - len, spec, (const char *)(uintptr_t)arg);
+                break;
+            case 'p':
+                strcpy(spec + flags, "p");
+                written = snprintf(buf + len, size - len, spec, (void *)(uintptr_t)arg);
+                break;
+            case 'M':
+                dhcp_format_mac(arg, text);
+                written = snprintf(buf + len, size - len, "%s", text);
+                break;
+            case 'I': {
+                uint32_t ip = htonl((uint32_t)arg);
+                inet_ntop(AF_INET, &ip, text, sizeof(text));
+                written = snprintf(buf + len, size - len, "%s", text);
+                break;
+            }
+            default:
+                break;
+        }
+        len += written > 0 ? (size_t)written : 0;
+        if (len >= size) {
+            len = size - 1;
+        }
+        p = conv;
+    }
+    return len;
+}
+
+void log_write(int level, const char *fmt, ...) {
+    log_ring *ring = log_started ? log_ring_self() : NULL;
+    log_record direct, *rec = &direct;
+    struct timespec ts;
+    size_t head = 0;
+    va_list ap;
+    int n = 0, wide;
+
+    // Sin hilo escritor (arranque, parada o sin anillo) se escribe directamente
+    if (ring != NULL) {
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SIZE) {
+            atomic_store_explicit(&ring->lost, atomic_load_explicit(&ring->lost, memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+        rec = &ring->records[head & (LOG_RING_SIZE - 1)];
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->fmt = fmt;
+    rec->level = level;
+
+    // Se copian los argumentos crudos según las conversiones del formato
+    va_start(ap, fmt);
+    for (const char *p = fmt; *p != '\0' && n < LOG_MAX_ARGS; p++) {
+        if (*p != '%' || *++p == '%') {
+            continue;
+        }
+        p = log_spec(p, &wide);
+        switch (*p) {
+            case 'd': case 'i':
+                rec->args[n++] = wide ? (uint64_t)va_arg(ap, long) : (uint64_t)(int64_t)va_arg(ap, int);
+                break;
+            case 'u': case 'x': case 'c': case 'I':
+                rec->args[n++] = wide ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+                break;
+            case 'M':
+                rec->args[n++] = va_arg(ap, uint64_t);
+                break;
+            case 'f': {
+                double value = va_arg(ap, double);
+                memcpy(&rec->args[n++], &value, sizeof(value));
+                break;
+            }
+            case 's': case 'p':
+                rec->args[n++] = (uint64_t)(uintptr_t)va_arg(ap, const void *);
+                break;
+            default:
+                break;
+        }
+        if (*p == '\0') {
+            break;
+        }
+    }
+    va_end(ap);
+
+    if (rec == &direct) {
+        char line[LOG_LINE_MAX];
+        size_t len = log_format(rec, line, sizeof(line) - 1);
+        line[len++] = '\n';
+        if (write(STDOUT_FILENO, line, len) < 0) {
+            // Sin salida no hay dónde informar del error
+        }
+        return;
+    }
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    if (atomic_load_explicit(&log_sleeping, memory_order_relaxed) && atomic_exchange(&log_sleeping, 0)) {
+        sem_post(&log_wake);
+    }
+}
+
+static int compare_log_records(const void *a, const void *b) {
+    uint64_t ta = (*(const log_record *const *)a)->ts_ns, tb = (*(const log_record *const *)b)->ts_ns;
+    return (ta > tb) - (ta < tb);
+}
+
+// Hilo escritor: vacía todos los anillos, ordena el lote por tiempo para
+// intercalar los hilos y lo escribe con una sola llamada por bloque
+void* log_thread(void* arg) {
+    (void)arg;
+    static log_record batch[LOG_BATCH];
+    static const log_record *order[LOG_BATCH];
+    static char out[1 << 16];
+    uint64_t reported_lost = 0;
+
+    while (1) {
+        int stopping = atomic_load(&log_stopping);
+        int rings = atomic_load(&log_ring_count);
+        int count = 0;
+
+        for (int k = 0; k < rings && count < LOG_BATCH; k++) {
+            log_ring *ring = log_rings[k];
+            if (ring == NULL) {
+                continue;
+            }
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+            while (tail != head && count < LOG_BATCH) {
+                batch[count] = ring->records[tail & (LOG_RING_SIZE - 1)];
+                order[count] = &batch[count];
+                count++;
+                tail++;
+            }
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+
+        if (count > 0) {
+            size_t used = 0;
+            qsort(order, count, sizeof(order[0]), compare_log_records);
+            for (int i = 0; i < count; i++) {
+                if (used + LOG_LINE_MAX > sizeof(out)) {
+                    if (write(STDOUT_FILENO, out, used) < 0) {
+                        break;
+                    }
+                    used = 0;
+                }
+                used += log_format(order[i], out + used, LOG_LINE_MAX - 1);
+                out[used++] = '\n';
+            }
+            if (used > 0 && write(STDOUT_FILENO, out, used) < 0) {
+                // Sin salida no hay dónde informar del error
+            }
+            continue;  // Puede quedar más trabajo: se repite sin dormir
+        }
+
+        uint64_t lost = 0;
+        for (int k = 0; k < rings; k++) {
+            if (log_rings[k] != NULL) {
+                lost += atomic_load_explicit(&log_rings[k]->lost, memory_order_relaxed);
+            }
+        }
+        if (lost != reported_lost) {
+            int len = snprintf(out, sizeof(out), "Registro saturado: %llu mensajes perdidos\n",
+                               (unsigned long long)(lost - reported_lost));
+            if (write(STDOUT_FILENO, out, len) < 0) {
+                // Ídem
+            }
+            reported_lost = lost;
+        }
+
+        if (stopping) {
+            return NULL;
+        }
+        // Se anuncia la espera y se vuelve a mirar antes de dormir para no perder avisos
+        atomic_store(&log_sleeping, 1);
+        int pending = 0;
+        for (int k = 0; k < atomic_load(&log_ring_count) && !pending; k++) {
+            log_ring *ring = log_rings[k];
+            pending = ring != NULL && atomic_load(&ring->tail) != atomic_load(&ring->head);
+        }
+        if (pending || atomic_load(&log_stopping)) {
+            atomic_store(&log_sleeping, 0);
+            continue;
+        }
+        while (sem_wait(&log_wake) != 0 && errno == EINTR)
+            ;
+    }
+}
+
+void log_start(void) {
+    sigset_t block, old;
+
+    fflush(stdout);
+    if (sem_init(&log_wake, 0, 0) != 0) {
+        perror("Error al inicializar el semáforo del registro");
+        exit(EXIT_FAILURE);
+    }
+
+    // Las señales de fin solo llegan al hilo principal
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (pthread_create(&log_thread_id, NULL, log_thread, NULL) != 0) {
+        perror("Error al crear el hilo de registro");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    log_started = 1;
+}
+
+// Vacía los registros pendientes y detiene el hilo escritor
+void log_stop(void) {
+    if (!log_started) {
+        return;
+    }
+    atomic_store(&log_stopping, 1);
+    atomic_store(&log_sleeping, 0);
+    sem_post(&log_wake);
+    pthread_join(log_thread_id, NULL);
+    log_started = 0;
+}
+
+unsigned int ip_to_int(const char *ip_str) {
+    struct sockaddr_in sa;
+    inet_pton(AF_INET, ip_str, &(sa.sin_addr));
+    return ntohl(sa.sin_addr.s_addr);
+}
+
+void int_to_ip(unsigned int ip, char *ip_str) {
+    struct in_addr addr;
+    addr.s_addr = htonl(ip);
+    inet_ntop(AF_INET, &addr, ip_str, INET_ADDRSTRLEN);
+}
+
+// Inicializa una cola MPMC con capacidad potencia de 2
+void ring_init(mpmc_ring *ring, size_t capacity) {
+    ring->cells = malloc(capacity * sizeof(ring_cell));
+    if (ring->cells == NULL) {
+        perror("Error al asignar memoria para la cola");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->cells[i].seq, i);
+    }
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+// Encola un índice; devuelve -1 si la cola está llena
+int ring_push(mpmc_ring *ring, unsigned int slot) {
+    size_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (;;) {
+        ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                cell->slot = slot;
+                atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+}
+
+// Desencola un índice; devuelve -1 si la cola está vacía
+int ring_pop(mpmc_ring *ring, unsigned int *slot) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        ring_cell *cell = &ring->cells[pos & ring->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *slot = cell->slot;
+                atomic_store_explicit(&cell->seq, pos + ring->mask + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+}
+
+// Reserva el bitmap con los primeros nbits marcados como libres
+void bitmap_init(ip_bitmap *bm, size_t nbits) {
+    size_t count = nbits;
+    bm->levels = 0;
+
+    do {
+        size_t nwords = (count + 63) / 64;
+        _Atomic uint64_t *words = malloc(nwords * sizeof(uint64_t));
+        if (words == NULL) {
+            perror("Error al asignar memoria para el bitmap");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < nwords; i++) {
+            size_t rest = count - i * 64;
+            atomic_init(&words[i], rest >= 64 ? ~0ULL : (1ULL << rest) - 1);
+        }
+        bm->words[bm->levels] = words;
+        bm->nwords[bm->levels] = nwords;
+        bm->levels++;
+        count = nwords;
+    } while (count > 1 && bm->levels < BITMAP_MAX_LEVELS);
+}
+
+// Propaga hacia arriba que la palabra idx del nivel dado tiene bits libres
+static void bitmap_mark_nonempty(ip_bitmap *bm, int level, size_t idx) {
+    while (level + 1 < bm->levels) {
+        size_t parent = idx >> 6;
+        uint64_t old = atomic_fetch_or(&bm->words[level + 1][parent], 1ULL << (idx & 63));
+        if (old != 0) {
+            return;
+        }
+        level++;
+        idx = parent;
+    }
+}
+
+// Propaga hacia arriba que la palabra idx del nivel dado quedó vacía
+static void bitmap_mark_empty(ip_bitmap *bm, int level, size_t idx) {
+    while (level + 1 < bm->levels) {
+        size_t parent = idx >> 6;
+        uint64_t bit = 1ULL << (idx & 63);
+        uint64_t old = atomic_fetch_and(&bm->words[level + 1][parent], ~bit);
+        // Una liberación concurrente pudo rellenar la palabra tras leerla vacía
+        if (atomic_load(&bm->words[level][idx]) != 0) {
+            bitmap_mark_nonempty(bm, level, idx);
+            return;
+        }
+        if ((old & ~bit) != 0) {
+            return;
+        }
+        level++;
+        idx = parent;
+    }
+}
+
+// Reclama atómicamente el primer bit libre; devuelve su índice o -1 si no hay
+long bitmap_alloc(ip_bitmap *bm) {
+    int top = bm->levels - 1;
+
+    while (atomic_load(&bm->words[top][0]) != 0) {
+        int level = top;
+        size_t idx = 0;
+
+        while (level > 0) {
+            uint64_t w = atomic_load(&bm->words[level][idx]);
+            if (w == 0) {
+                break;
+            }
+            idx = idx * 64 + __builtin_ctzll(w);
+            level--;
+        }
+
+        if (level == 0) {
+            uint64_t w = atomic_load(&bm->words[0][idx]);
+            while (w != 0) {
+                uint64_t bit = w & -w;
+                if (atomic_compare_exchange_weak(&bm->words[0][idx], &w, w & ~bit)) {
+                    if ((w & ~bit) == 0) {
+                        bitmap_mark_empty(bm, 0, idx);
+                    }
+                    return idx * 64 + __builtin_ctzll(bit);
+                }
+            }
+        }
+        // El resumen estaba desactualizado: se corrige y se vuelve a descender
+        bitmap_mark_empty(bm, level, idx);
+    }
+    return -1;
+}
+
+// Reclama un bit concreto; devuelve 1 si estaba libre
+int bitmap_claim(ip_bitmap *bm, size_t bit) {
+    size_t idx = bit >> 6;
+    uint64_t mask = 1ULL << (bit & 63);
+    uint64_t old = atomic_fetch_and(&bm->words[0][idx], ~mask);
+    if (!(old & mask)) {
+        return 0;
+    }
+    if ((old & ~mask) == 0) {
+        bitmap_mark_empty(bm, 0, idx);
+    }
+    return 1;
+}
+
+// Devuelve un bit al bitmap
+void bitmap_free(ip_bitmap *bm, size_t bit) {
+    size_t idx = bit >> 6;
+    uint64_t old = atomic_fetch_or(&bm->words[0][idx], 1ULL << (bit & 63));
+    if (old == 0) {
+        bitmap_mark_nonempty(bm, 0, idx);
+    }
+}
+
+#define DECLINED_MAC (1ULL << 48)  // Titular ficticio de una IP rechazada (no es una MAC de 48 bits)
+#define MAC_BUCKET_EMPTY 0ULL
+
+// Convierte una MAC "XX:XX:XX:XX:XX:XX" a entero; devuelve 0 si el formato es inválido
+uint64_t parse_mac(const char *str) {
+    uint64_t mac = 0;
+    for (int i = 0; i < 17; i++) {
+        char c = str[i];
+        if (i % 3 == 2) {
+            if (c != ':' && c != '-') {
+                return 0;
+            }
+            continue;
+        }
+        int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            nibble = (c | 0x20) - 'a' + 10;
+        } else {
+            return 0;
+        }
+        mac = (mac << 4) | nibble;
+    }
+    return mac;
+}
+
+static uint64_t mac_hash(uint64_t mac) {
+    mac ^= mac >> 33;
+    mac *= 0xff51afd7ed558ccdULL;
+    mac ^= mac >> 33;
+    mac *= 0xc4ceb9fe1a85ec53ULL;
+    mac ^= mac >> 33;
+    return mac;
+}
+
+// Cubeta = etiqueta de 31 bits (nunca 0) en la parte alta + índice de la entrada. La
+// posición inicial de la cubeta sale de la etiqueta, así que un borrado puede calcular
+// la de cualquier cubeta sin consultar el pool
+static uint64_t mac_bucket(uint64_t hash, int slot) {
+    uint64_t tag = ((hash >> 32) & 0x7fffffff) | 1;
+    return (tag << 32) | (uint32_t)slot;
+}
+
+static inline size_t mac_bucket_home(uint64_t bucket, size_t mask) {
+    return (bucket >> 33) & mask;
+}
+
+static inline mac_index_part *mac_index_part_of(mac_index *index, uint64_t hash) {
+    return &index->parts[hash & (MAC_INDEX_PARTS - 1)];
+}
+
+// Reserva un índice con al menos el doble de cubetas que entradas del pool
+void mac_index_init(mac_index *index, ip_entry *entries, size_t count) {
+    size_t capacity = 16;
+    while (capacity * MAC_INDEX_PARTS < count * 2) {
+        capacity <<= 1;
+    }
+    for (int p = 0; p < MAC_INDEX_PARTS; p++) {
+        mac_index_part *part = &index->parts[p];
+        part->buckets = calloc(capacity, sizeof(uint64_t));
+        if (part->buckets == NULL) {
+            perror("Error al asignar memoria para el índice de MACs");
+            exit(EXIT_FAILURE);
+        }
+        part->mask = capacity - 1;
+        atomic_init(&part->version, 0);
+        pthread_mutex_init(&part->lock, NULL);
+    }
+    index->entries = entries;
+}
+
+void mac_index_free(mac_index *index) {
+    for (int p = 0; p < MAC_INDEX_PARTS; p++) {
+        free(index->parts[p].buckets);
+        pthread_mutex_destroy(&index->parts[p].lock);
+    }
+}
+
+// Recorre la cadena de una MAC guardando hasta max entradas suyas dentro de [lo, hi)
+// (y con lease u oferta si only_bound). Si no encuentra todas las que pide y un borrado
+// movió cubetas mientras tanto, vuelve a empezar: un desplazamiento pudo ocultarle una
+static int mac_index_probe(mac_index *index, uint64_t mac, long lo, long hi, int only_bound, int *slots, int max) {
+    uint64_t hash = mac_hash(mac);
+    uint32_t tag = mac_bucket(hash, 0) >> 32;
+    mac_index_part *part = mac_index_part_of(index, hash);
+    int found;
+
+    while (1) {
+        unsigned int version = atomic_load_explicit(&part->version, memory_order_acquire);
+        size_t mask = part->mask;
+        found = 0;
+        for (size_t n = 0, b = (tag >> 1) & mask; n <= mask && found < max; n++, b = (b + 1) & mask) {
+            uint64_t bucket = atomic_load_explicit(&part->buckets[b], memory_order_acquire);
+            if (bucket == MAC_BUCKET_EMPTY) {
+                break;
+            }
+            if ((bucket >> 32) == tag) {
+                int slot = (uint32_t)bucket;
+                if (slot >= lo && slot < hi && atomic_load(&index->entries[slot].client_mac) == mac &&
+                    (!only_bound || atomic_load(&index->entries[slot].state) != ENTRY_LIBRE)) {
+                    // Un desplazamiento puede dejar la misma cubeta dos veces en la cadena
+                    int k = 0;
+                    while (k < found && slots[k] != slot) {
+                        k++;
+                    }
+                    if (k == found) {
+                        slots[found++] = slot;
+                    }
+                }
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (found == max || ((version & 1) == 0 && atomic_load_explicit(&part->version, memory_order_relaxed) == version)) {
+            return found;
+        }
+    }
+}
+
+// Busca la entrada asignada a una MAC dentro de [lo, hi) del pool; devuelve su índice
+// o -1. El rango separa las concesiones de un mismo cliente en ámbitos distintos.
+int mac_index_lookup(mac_index *index, uint64_t mac, long lo, long hi) {
+    int slot;
+    return mac_index_probe(index, mac, lo, hi, 1, &slot, 1) ? slot : -1;
+}
+
+// Guarda en slots las entradas asignadas a una MAC en todo el pool (una por ámbito como
+// mucho); devuelve cuántas encontró
+int mac_index_find_all(mac_index *index, uint64_t mac, int *slots, int max) {
+    return mac_index_probe(index, mac, 0, LONG_MAX, 0, slots, max);
+}
+
+// Inserta MAC -> entrada en el primer hueco de su cadena
+void mac_index_insert(mac_index *index, uint64_t mac, int slot) {
+    uint64_t hash = mac_hash(mac);
+    uint64_t value = mac_bucket(hash, slot);
+    mac_index_part *part = mac_index_part_of(index, hash);
+
+    pthread_mutex_lock(&part->lock);
+    for (size_t n = 0, b = mac_bucket_home(value, part->mask); n <= part->mask; n++, b = (b + 1) & part->mask) {
+        if (atomic_load_explicit(&part->buckets[b], memory_order_relaxed) == MAC_BUCKET_EMPTY) {
+            atomic_store_explicit(&part->buckets[b], value, memory_order_release);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&part->lock);
+}
+
+// Elimina la cubeta MAC -> entrada si existe. Las cubetas siguientes de la agrupación se
+// adelantan al hueco si su posición inicial no está entre el hueco y su posición actual
+// (como pending_remove en el relay); cada una se copia antes de vaciar su sitio, así que
+// un lector nunca encuentra un hueco falso, aunque puede no ver una cubeta que se mueve
+// y por eso repite si la versión cambió
+void mac_index_remove(mac_index *index, uint64_t mac, int slot) {
+    uint64_t hash = mac_hash(mac);
+    uint64_t value = mac_bucket(hash, slot);
+    mac_index_part *part = mac_index_part_of(index, hash);
+    size_t mask = part->mask;
+    size_t i = mac_bucket_home(value, mask), n;
+
+    pthread_mutex_lock(&part->lock);
+    for (n = 0; n <= mask; n++, i = (i + 1) & mask) {
+        uint64_t bucket = atomic_load_explicit(&part->buckets[i], memory_order_relaxed);
+        if (bucket == MAC_BUCKET_EMPTY || bucket == value) {
+            break;
+        }
+    }
+    if (n > mask || atomic_load_explicit(&part->buckets[i], memory_order_relaxed) != value) {
+        pthread_mutex_unlock(&part->lock);
+        return;
+    }
+
+    unsigned int version = atomic_load_explicit(&part->version, memory_order_relaxed);
+    atomic_store_explicit(&part->version, version + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (size_t j = (i + 1) & mask;; j = (j + 1) & mask) {
+        uint64_t bucket = atomic_load_explicit(&part->buckets[j], memory_order_relaxed);
+        if (bucket == MAC_BUCKET_EMPTY) {
+            break;
+        }
+        if (((j - mac_bucket_home(bucket, mask)) & mask) >= ((j - i) & mask)) {
+            atomic_store_explicit(&part->buckets[i], bucket, memory_order_release);
+            i = j;
+        }
+    }
+    atomic_store_explicit(&part->buckets[i], MAC_BUCKET_EMPTY, memory_order_release);
+    atomic_store_explicit(&part->version, version + 2, memory_order_release);
+    pthread_mutex_unlock(&part->lock);
+}
+
+// Abre la escritura de una entrada poniendo su secuencia en impar. Dos escritores de la
+// misma entrada son raros y sus secciones no toman cerrojos: el segundo espera girando
+static inline void entry_write_begin(ip_entry *e) {
+    unsigned int seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    while (1) {
+        if ((seq & 1) == 0 &&
+            atomic_compare_exchange_weak_explicit(&e->seq, &seq, seq + 1, memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        if (seq & 1) {
+            seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+        }
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void entry_write_end(ip_entry *e) {
+    atomic_fetch_add_explicit(&e->seq, 1, memory_order_release);
+}
+
+// Fija titular, estado y expiración de una entrada de una sola vez
+static void entry_set(ip_entry *e, uint64_t mac, int state, time_t expires) {
+    entry_write_begin(e);
+    atomic_store(&e->client_mac, mac);
+    atomic_store(&e->state, state);
+    e->lease_expiration = expires;
+    entry_write_end(e);
+}
+
+// Copia coherente de una entrada sin escribir en memoria compartida: un lector nunca
+// retrasa a la asignación y solo repite si un escritor la modificó mientras leía
+typedef struct {
+    uint64_t mac;
+    int state;
+    time_t expires;
+} entry_snapshot;
+
+static entry_snapshot entry_read(ip_entry *e) {
+    entry_snapshot snap;
+    unsigned int before, after;
+
+    do {
+        before = atomic_load_explicit(&e->seq, memory_order_acquire);
+        snap.mac = atomic_load_explicit(&e->client_mac, memory_order_relaxed);
+        snap.state = atomic_load_explicit(&e->state, memory_order_relaxed);
+        snap.expires = __atomic_load_n(&e->lease_expiration, __ATOMIC_RELAXED);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return snap;
+}
+
+// Inicializa la rueda de temporizadores de una configuración en el segundo actual
+void wheel_init(lease_wheel *wheel, pool_config *config, time_t now) {
+    pthread_mutex_init(&wheel->lock, NULL);
+    wheel->now = now;
+    wheel->config = config;
+    for (int i = 0; i < WHEEL_LEVELS * WHEEL_SIZE; i++) {
+        wheel->heads[i] = -1;
+    }
+}
+
+// Quita una entrada de su ranura (con el cerrojo de la rueda tomado)
+static void wheel_unlink(lease_wheel *wheel, int i) {
+    ip_entry *ip_pool = wheel->config->ip_pool;
+    ip_entry *e = &ip_pool[i];
+    if (e->timer_slot < 0) {
+        return;
+    }
+    if (e->timer_prev >= 0) {
+        ip_pool[e->timer_prev].timer_next = e->timer_next;
+    } else {
+        wheel->heads[e->timer_slot] = e->timer_next;
+    }
+    if (e->timer_next >= 0) {
+        ip_pool[e->timer_next].timer_prev = e->timer_prev;
+    }
+    e->timer_slot = -1;
+}
+
+// Enlaza una entrada en la ranura que corresponde a su expiración (con el cerrojo tomado)
+static void wheel_link(lease_wheel *wheel, int i) {
+    ip_entry *ip_pool = wheel->config->ip_pool;
+    ip_entry *e = &ip_pool[i];
+    time_t expires = e->lease_expiration;
+    time_t delta = expires - wheel->now;
+    int level = 0;
+
+    if (delta < 1) {
+        expires = wheel->now + 1;
+        delta = 1;
+    }
+    while (level < WHEEL_LEVELS - 1 && delta >= ((time_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    // Más allá del alcance: queda en el último nivel y se reevalúa al bajar
+    if (delta >= ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS))) {
+        expires = wheel->now + ((time_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    int slot = level * WHEEL_SIZE + ((expires >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1));
+    e->timer_slot = slot;
+    e->timer_prev = -1;
+    e->timer_next = wheel->heads[slot];
+    if (e->timer_next >= 0) {
+        ip_pool[e->timer_next].timer_prev = i;
+    }
+    wheel->heads[slot] = i;
+}
+
+// Programa (o reprograma) la expiración de una entrada
+void wheel_schedule(lease_wheel *wheel, int i, time_t expires) {
+    ip_entry *e = &wheel->config->ip_pool[i];
+
+    pthread_mutex_lock(&wheel->lock);
+    wheel_unlink(wheel, i);
+    entry_write_begin(e);
+    e->lease_expiration = expires;
+    entry_write_end(e);
+    wheel_link(wheel, i);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+// Cancela la expiración programada de una entrada
+void wheel_cancel(lease_wheel *wheel, int i) {
+    pthread_mutex_lock(&wheel->lock);
+    wheel_unlink(wheel, i);
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+// Renueva una entrada solo si sigue en el estado indicado; devuelve 1 si se renovó
+int wheel_renew(lease_wheel *wheel, int i, int state, time_t expires) {
+    ip_entry *e = &wheel->config->ip_pool[i];
+    int renewed = 0;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (atomic_load(&e->state) == state) {
+        wheel_unlink(wheel, i);
+        entry_write_begin(e);
+        e->lease_expiration = expires;
+        entry_write_end(e);
+        wheel_link(wheel, i);
+        renewed = 1;
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return renewed;
+}
+
+// Convierte la oferta o el lease de la MAC en un lease hasta 'expires'; devuelve el
+// estado anterior (ENTRY_LIBRE si la entrada ya no es del cliente)
+int wheel_commit(lease_wheel *wheel, int i, uint64_t mac, time_t expires) {
+    ip_entry *e = &wheel->config->ip_pool[i];
+    int previous = ENTRY_LIBRE;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (atomic_load(&e->client_mac) == mac) {
+        previous = atomic_load(&e->state);
+        // Una liberación concurrente (fuera del cerrojo) gana: la entrada ya no es suya
+        entry_write_begin(e);
+        if (previous != ENTRY_LIBRE && atomic_compare_exchange_strong(&e->state, &previous, ENTRY_ASIGNADA)) {
+            e->lease_expiration = expires;
+            entry_write_end(e);
+            wheel_unlink(wheel, i);
+            wheel_link(wheel, i);
+        } else {
+            entry_write_end(e);
+            previous = ENTRY_LIBRE;
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+    return previous;
+}
+
+static int lpm_new_node(lpm_trie *trie) {
+    if (trie->count == trie->capacity) {
+        trie->capacity = trie->capacity ? trie->capacity * 2 : 64;
+        trie->nodes = realloc(trie->nodes, trie->capacity * sizeof(lpm_node));
+        if (trie->nodes == NULL) {
+            perror("Error al asignar memoria para el árbol de ámbitos");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trie->nodes[trie->count] = (lpm_node){{-1, -1}, -1};
+    return trie->count++;
+}
+
+// Asocia un prefijo a un ámbito; devuelve -1 si el prefijo ya estaba
+int lpm_insert(lpm_trie *trie, uint32_t prefix, int len, int scope) {
+    int node = 0;
+
+    if (trie->count == 0) {
+        lpm_new_node(trie);
+    }
+    for (int depth = 0; depth < len; depth++) {
+        int bit = (prefix >> (31 - depth)) & 1;
+        if (trie->nodes[node].child[bit] < 0) {
+            int child = lpm_new_node(trie);
+            trie->nodes[node].child[bit] = child;
+        }
+        node = trie->nodes[node].child[bit];
+    }
+    if (trie->nodes[node].scope >= 0) {
+        return -1;
+    }
+    trie->nodes[node].scope = scope;
+    return 0;
+}
+
+// Ámbito del prefijo más largo que contiene la dirección (orden de host) o -1
+int lpm_lookup(const lpm_trie *trie, uint32_t addr) {
+    int node = trie->count > 0 ? 0 : -1;
+    int best = -1;
+
+    for (int depth = 0; node >= 0; depth++) {
+        if (trie->nodes[node].scope >= 0) {
+            best = trie->nodes[node].scope;
+        }
+        if (depth == 32) {
+            break;
+        }
+        node = trie->nodes[node].child[(addr >> (31 - depth)) & 1];
+    }
+    return best;
+}
+
+static uint32_t prefix_mask(int len) {
+    return len == 0 ? 0 : 0xffffffffu << (32 - len);
+}
+
+// Índice en el pool de una IP (orden de host) o -1 si no pertenece a ningún rango
+static long pool_index(const pool_config *cfg, uint32_t ip) {
+    int s = lpm_lookup(&cfg->trie, ip);
+    if (s < 0 || ip < cfg->scopes[s].range_start || ip > cfg->scopes[s].range_end) {
+        return -1;
+    }
+    return cfg->scopes[s].first + (ip - cfg->scopes[s].range_start);
+}
+
+// Ámbito de una solicitud: el del relay (giaddr); si no hay relay, el de la IP del
+// cliente (ciaddr) o el de la interfaz del propio servidor. NULL si no hay ninguno.
+static dhcp_scope *select_scope(pool_config *cfg, const dhcp_packet *msg) {
+    uint32_t key = msg->giaddr != 0 ? msg->giaddr : msg->ciaddr != 0 ? msg->ciaddr : server_id;
+    int s = lpm_lookup(&cfg->trie, ntohl(key));
+    if (s < 0) {
+        s = cfg->default_scope;
+    }
+    return s >= 0 ? &cfg->scopes[s] : NULL;
+}
+
+// En un par HA, la IP es de la mitad del otro servidor: aquí no se ofrece ni se
+// reclama, solo se vincula con lo que él replica
+static inline int peer_owned(uint32_t ip) {
+    return ha.enabled && (int)(ip & 1) != ha.role;
+}
+
+static int compare_scope_ranges(const void *a, const void *b) {
+    uint32_t sa = (*(const dhcp_scope *const *)a)->range_start, sb = (*(const dhcp_scope *const *)b)->range_start;
+    return (sa > sb) - (sa < sb);
+}
+
+// Reparte el pool entre los ámbitos de la configuración, crea sus particiones y
+// retira las exclusiones; devuelve -1 si los rangos se solapan
+int init_ip_pool(pool_config *cfg) {
+    if (cfg->num_scopes == 0) {
+        fprintf(stderr, "No hay ningún ámbito definido\n");
+        return -1;
+    }
+    const dhcp_scope **order = malloc(cfg->num_scopes * sizeof(dhcp_scope *));
+    if (order == NULL) {
+        perror("Error al asignar memoria para los ámbitos");
+        exit(EXIT_FAILURE);
+    }
+
+    // Los rangos no pueden solaparse y cada uno debe resolverse a su propio ámbito
+    for (int s = 0; s < cfg->num_scopes; s++) {
+        order[s] = &cfg->scopes[s];
+    }
+    qsort(order, cfg->num_scopes, sizeof(dhcp_scope *), compare_scope_ranges);
+    for (int k = 0; k < cfg->num_scopes; k++) {
+        const dhcp_scope *scope = order[k];
+        int s = scope - cfg->scopes;
+        if ((k > 0 && order[k - 1]->range_end >= scope->range_start) ||
+            lpm_lookup(&cfg->trie, scope->range_start) != s || lpm_lookup(&cfg->trie, scope->range_end) != s) {
+            fprintf(stderr, "El rango %u.%u.%u.%u-%u.%u.%u.%u se solapa con otro ámbito\n",
+                    scope->range_start >> 24, (scope->range_start >> 16) & 255, (scope->range_start >> 8) & 255,
+                    scope->range_start & 255, scope->range_end >> 24, (scope->range_end >> 16) & 255,
+                    (scope->range_end >> 8) & 255, scope->range_end & 255);
+            free(order);
+            return -1;
+        }
+    }
+    free(order);
+
+    cfg->pool_size = 0;
+    cfg->num_shards = 0;
+    for (int s = 0; s < cfg->num_scopes; s++) {
+        dhcp_scope *scope = &cfg->scopes[s];
+        scope->first = cfg->pool_size;
+        scope->parts = num_parts < scope->count ? num_parts : scope->count;
+        scope->first_shard = cfg->num_shards;
+        cfg->pool_size += scope->count;
+        cfg->num_shards += scope->parts;
+    }
+
+    cfg->ip_pool = (ip_entry *)malloc(cfg->pool_size * sizeof(ip_entry));
+    cfg->shards = calloc(cfg->num_shards, sizeof(pool_shard));
+    if (cfg->ip_pool == NULL || cfg->shards == NULL) {
+        perror("Error al asignar memoria para el pool de IPs");
+        exit(EXIT_FAILURE);
+    }
+    mac_index_init(&cfg->lease_index, cfg->ip_pool, cfg->pool_size);
+
+    for (int s = 0; s < cfg->num_scopes; s++) {
+        dhcp_scope *scope = &cfg->scopes[s];
+        // Particiones contiguas del mismo tamaño (la última puede ser menor)
+        long span = (scope->count + scope->parts - 1) / scope->parts;
+        for (int k = 0; k < scope->parts; k++) {
+            pool_shard *shard = &cfg->shards[scope->first_shard + k];
+            shard->first = scope->first + k * span;
+            shard->count = (k == scope->parts - 1) ? scope->first + scope->count - shard->first : span;
+            shard->part = k;
+            bitmap_init(&shard->free_map, shard->count);
+            wheel_init(&shard->timers, cfg, time(NULL));
+        }
+        for (long j = 0; j < scope->count; j++) {
+            long i = scope->first + j;
+            cfg->ip_pool[i].ip_addr = scope->range_start + j;
+            atomic_init(&cfg->ip_pool[i].seq, 0);
+            atomic_init(&cfg->ip_pool[i].state, ENTRY_LIBRE);
+            atomic_init(&cfg->ip_pool[i].client_mac, 0);
+            cfg->ip_pool[i].lease_expiration = 0;
+            cfg->ip_pool[i].timer_slot = -1;
+            cfg->ip_pool[i].shard = scope->first_shard + j / span;
+        }
+    }
+
+    // Una dirección excluida queda reclamada en el bitmap desde el principio: no se
+    // ofrece, no se confirma y ningún lease recuperado o migrado puede ocuparla
+    cfg->excluded = 0;
+    for (int x = 0; x < cfg->num_exclusions; x++) {
+        for (uint64_t ip = cfg->exclusions[x].first; ip <= cfg->exclusions[x].last; ip++) {
+            long i = pool_index(cfg, ip);
+            if (i >= 0) {
+                pool_shard *shard = &cfg->shards[cfg->ip_pool[i].shard];
+                cfg->excluded += bitmap_claim(&shard->free_map, i - shard->first);
+            }
+        }
+    }
+
+    // Las IPs reservadas del rango tampoco entran en el reparto dinámico
+    for (size_t k = 0; k < cfg->reservations.count; k++) {
+        long i = pool_index(cfg, cfg->reservations.ips[k]);
+        if (i >= 0) {
+            pool_shard *shard = &cfg->shards[cfg->ip_pool[i].shard];
+            bitmap_claim(&shard->free_map, i - shard->first);
+        }
+    }
+
+    // La mitad del otro servidor del par queda igualmente reclamada para siempre
+    for (long i = 0; ha.enabled && i < cfg->pool_size; i++) {
+        if (peer_owned(cfg->ip_pool[i].ip_addr)) {
+            pool_shard *shard = &cfg->shards[cfg->ip_pool[i].shard];
+            bitmap_claim(&shard->free_map, i - shard->first);
+        }
+    }
+    return 0;
+}
+
+// Libera una configuración que ya no puede leer ningún hilo
+void free_config(pool_config *cfg) {
+    for (int k = 0; k < cfg->num_shards; k++) {
+        for (int level = 0; level < cfg->shards[k].free_map.levels; level++) {
+            free(cfg->shards[k].free_map.words[level]);
+        }
+        pthread_mutex_destroy(&cfg->shards[k].timers.lock);
+    }
+    free(cfg->shards);
+    free(cfg->ip_pool);
+    mac_index_free(&cfg->lease_index);
+    free(cfg->trie.nodes);
+    free(cfg->scopes);
+    free(cfg->exclusions);
+    free(cfg->reservations.keys);
+    free(cfg->reservations.ips);
+    free(cfg->reservations.seeds);
+    free(cfg->reservations.by_ip);
+    free(cfg);
+}
+
+static inline pool_shard *shard_of(pool_config *cfg, long i) {
+    return &cfg->shards[cfg->ip_pool[i].shard];
+}
+
+// Anota que la entrada de una IP cambió para que el escritor del diario la persista.
+// Se encola la IP y no el índice, que cambia de una configuración a otra.
+static void journal_note(uint32_t ip) {
+    if (!journal.enabled) {
+        return;
+    }
+    if (ring_push(&journal.pending, ip) != 0) {
+        atomic_store(&journal.overflow, 1);
+    }
+    if (atomic_load_explicit(&journal.sleeping, memory_order_relaxed) && atomic_exchange(&journal.sleeping, 0)) {
+        sem_post(&journal.wake);
+    }
+}
+
+// Anota la IP de un lease modificado para enviarla al otro servidor del par. Nunca
+// espera: si la cola está llena se le enviará más tarde el estado completo
+static void replica_note(uint32_t ip) {
+    if (!ha.enabled) {
+        return;
+    }
+    if (ring_push(&ha.pending, ip) != 0) {
+        atomic_store(&ha.overflow, 1);
+    }
+    if (atomic_load_explicit(&ha.sleeping, memory_order_relaxed) && atomic_exchange(&ha.sleeping, 0)) {
+        uint64_t one = 1;
+        if (write(ha.wake_fd, &one, sizeof(one)) < 0) {
+            // El contador del eventfd ya estaba saturado: el hilo despertará igualmente
+        }
+    }
+}
+
+// Un lease cambió en este servidor: se persiste y se replica
+static void lease_changed(uint32_t ip) {
+    journal_note(ip);
+    replica_note(ip);
+}
+
+// Vincula una entrada recién reclamada a la MAC del cliente como oferta o como lease.
+// Las ofertas no se persisten: tras un reinicio el DHCPREQUEST vuelve a reclamar la IP
+static void bind_entry(pool_config *cfg, long i, uint64_t mac, int state, time_t expires) {
+    entry_set(&cfg->ip_pool[i], mac, state, expires);
+    mac_index_insert(&cfg->lease_index, mac, i);
+    wheel_schedule(&shard_of(cfg, i)->timers, i, expires);
+    if (state == ENTRY_OFRECIDA) {
+        metric_offered(1);
+        return;
+    }
+    metric_leased(1);
+    lease_changed(cfg->ip_pool[i].ip_addr);
+}
+
+// Elige la IP que se ofrece a un DHCPDISCOVER. Un cliente con lease recibe su misma
+// dirección sin alargarlo; uno con una oferta pendiente recibe la misma oferta. Si no,
+// se reserva una IP libre durante offer_time segundos
+int assign_ip_dynamic(pool_config *cfg, dhcp_scope *scope, uint64_t mac, uint32_t *assigned_ip) {
+    long i = mac_index_lookup(&cfg->lease_index, mac, scope->first, scope->first + scope->count);
+    if (i >= 0) {
+        if (atomic_load(&cfg->ip_pool[i].state) == ENTRY_ASIGNADA ||
+            wheel_renew(&shard_of(cfg, i)->timers, i, ENTRY_OFRECIDA, time(NULL) + offer_time)) {
+            *assigned_ip = cfg->ip_pool[i].ip_addr;
+            return 0;
+        }
+    }
+
+    // Primero la partición propia; si está agotada se toma prestada de las demás
+    i = -1;
+    for (int k = 0; k < scope->parts && i < 0; k++) {
+        pool_shard *shard = &cfg->shards[scope->first_shard + (home_shard + k) % scope->parts];
+        long bit = bitmap_alloc(&shard->free_map);
+        if (bit >= 0) {
+            i = shard->first + bit;
+        }
+    }
+    if (i < 0) {
+        return -1;
+    }
+
+    // El bit reclamado da propiedad exclusiva de la entrada
+    bind_entry(cfg, i, mac, ENTRY_OFRECIDA, time(NULL) + offer_time);
+    *assigned_ip = cfg->ip_pool[i].ip_addr;
+    return 0;
+}
+
+// Confirma una oferta o renueva la IP solicitada; devuelve 1 (ACK) o 0 (NAK) si pertenece
+// a otro cliente o no es del ámbito del cliente (por ejemplo, porque cambió de subred).
+// Devuelve -1 si no hay que responder porque la decide el otro servidor del par
+int request_ip(pool_config *cfg, dhcp_scope *scope, uint64_t mac, uint32_t ip) {
+    long i = pool_index(cfg, ip);
+    if (i < scope->first || i >= scope->first + scope->count) {
+        return 0;
+    }
+
+    pool_shard *shard = shard_of(cfg, i);
+    int previous = wheel_commit(&shard->timers, i, mac, time(NULL) + scope->lease_time);
+    if (previous != ENTRY_LIBRE) {
+        if (previous == ENTRY_OFRECIDA) {
+            metric_offered(-1);
+            metric_leased(1);
+        }
+        lease_changed(ip);
+        return 1;
+    }
+    // La dirección del otro servidor del par sin lease conocido: responde él
+    if (peer_owned(ip)) {
+        return -1;
+    }
+    // La dirección expiró o se liberó: se vuelve a reclamar para el mismo cliente si sigue libre
+    if (bitmap_claim(&shard->free_map, i - shard->first)) {
+        bind_entry(cfg, i, mac, ENTRY_ASIGNADA, time(NULL) + scope->lease_time);
+        return 1;
+    }
+    return 0;
+}
+
+// Devuelve una entrada ocupada al bitmap; solo el primero que la libera la devuelve.
+// Devuelve el estado que tenía (ENTRY_LIBRE si ya estaba libre)
+static int release_entry(pool_config *cfg, long i) {
+    ip_entry *e = &cfg->ip_pool[i];
+    uint64_t holder = 0;
+
+    entry_write_begin(e);
+    int previous = atomic_exchange(&e->state, ENTRY_LIBRE);
+    if (previous != ENTRY_LIBRE) {
+        holder = atomic_exchange(&e->client_mac, 0);
+    }
+    entry_write_end(e);
+    if (previous != ENTRY_LIBRE) {
+        mac_index_remove(&cfg->lease_index, holder, i);
+        pool_shard *shard = shard_of(cfg, i);
+        if (!peer_owned(cfg->ip_pool[i].ip_addr)) {
+            bitmap_free(&shard->free_map, i - shard->first);
+        }
+        if (previous == ENTRY_OFRECIDA) {
+            metric_offered(-1);
+        } else {
+            metric_leased(-1);
+            lease_changed(cfg->ip_pool[i].ip_addr);
+        }
+    }
+    return previous;
+}
+
+// Libera una IP en función del mensaje DHCPRELEASE (solo si la MAC es su titular)
+void release_ip_dynamic(pool_config *cfg, uint64_t mac, uint32_t ip) {
+    long i = pool_index(cfg, ip);
+    if (i < 0 || atomic_load(&cfg->ip_pool[i].client_mac) != mac) {
+        return;
+    }
+    wheel_cancel(&shard_of(cfg, i)->timers, i);
+    if (release_entry(cfg, i)) {
+        LOG(LOG_INFO, "IP %I liberada", ip);
+    }
+}
+
+// DHCPDECLINE: la IP está en uso en la red. Se retira del índice del cliente pero
+// sigue ocupada hasta que venza su lease para no volver a ofrecerla enseguida
+void decline_ip(pool_config *cfg, uint64_t mac, uint32_t ip) {
+    long i = pool_index(cfg, ip);
+    if (i < 0 || atomic_load(&cfg->ip_pool[i].client_mac) != mac) {
+        return;
+    }
+    mac_index_remove(&cfg->lease_index, mac, i);
+    entry_write_begin(&cfg->ip_pool[i]);
+    atomic_store(&cfg->ip_pool[i].client_mac, DECLINED_MAC);
+    entry_write_end(&cfg->ip_pool[i]);
+    lease_changed(ip);
+}
+
+// Vacía una ranura y reinserta sus entradas según su expiración actual
+static void wheel_cascade(lease_wheel *wheel, int slot) {
+    ip_entry *ip_pool = wheel->config->ip_pool;
+    int i = wheel->heads[slot];
+    wheel->heads[slot] = -1;
+    while (i >= 0) {
+        int next = ip_pool[i].timer_next;
+        ip_pool[i].timer_slot = -1;
+        wheel_link(wheel, i);
+        i = next;
+    }
+}
+
+// Avanza la rueda hasta el segundo indicado liberando los leases vencidos
+void wheel_advance(lease_wheel *wheel, time_t now) {
+    ip_entry *ip_pool = wheel->config->ip_pool;
+
+    pthread_mutex_lock(&wheel->lock);
+    while (wheel->now < now) {
+        time_t t = ++wheel->now;
+
+        // Al completar una vuelta se bajan las entradas del nivel superior
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            if ((t & (((time_t)1 << (WHEEL_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            wheel_cascade(wheel, level * WHEEL_SIZE + ((t >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)));
+        }
+
+        int slot = t & (WHEEL_SIZE - 1);
+        int i = wheel->heads[slot];
+        wheel->heads[slot] = -1;
+        while (i >= 0) {
+            int next = ip_pool[i].timer_next;
+            ip_pool[i].timer_slot = -1;
+            if (ip_pool[i].lease_expiration <= t) {
+                int previous = release_entry(wheel->config, i);
+                if (previous == ENTRY_ASIGNADA) {
+                    LOG(LOG_INFO, "El tiempo de concesión de la IP %I ha expirado, liberada", ip_pool[i].ip_addr);
+                    metric_add(&metrics()->expired, 1);
+                } else if (previous == ENTRY_OFRECIDA) {
+                    LOG(LOG_DEBUG, "Oferta de la IP %I sin DHCPREQUEST, devuelta al pool", ip_pool[i].ip_addr);
+                    metric_add(&metrics()->offers_expired, 1);
+                }
+            } else {
+                wheel_link(wheel, i);
+            }
+            i = next;
+        }
+    }
+    pthread_mutex_unlock(&wheel->lock);
+}
+
+// Verifica si las concesiones de IP han expirado (hilo principal, que es quien
+// publica las configuraciones y por tanto no necesita sección de época)
+void check_ip_leases() {
+    pool_config *cfg = atomic_load(&active_config);
+    time_t now = time(NULL);
+    for (int k = 0; k < cfg->num_shards; k++) {
+        wheel_advance(&cfg->shards[k].timers, now);
+    }
+}
+
+// Prepara los descriptores fijos de un lote de respuestas
+reply_batch *reply_batch_create(void) {
+    reply_batch *batch = calloc(1, sizeof(reply_batch));
+    if (batch == NULL) {
+        perror("Error al asignar memoria para el lote de respuestas");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < MAX_BATCH; i++) {
+        batch->iov[i].iov_base = &batch->msgs[i];
+        batch->hdrs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        batch->hdrs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return batch;
+}
+
+// ---------------------------------------------------------------------------
+// Backend io_uring (-m uring), con llamadas al sistema directas. Cada hilo de
+// partición tiene su anillo: una recepción multishot va llenando búferes que el
+// núcleo toma de un anillo de búferes registrado, y cada respuesta se encola como
+// envío en el mismo anillo. Una sola llamada a io_uring_enter entrega los envíos y
+// espera los siguientes paquetes.
+// ---------------------------------------------------------------------------
+
+// Marcas en los 32 bits altos de user_data de cada operación
+enum { URING_RECV = 1, URING_TIMER, URING_SEND };
+
+// Respuesta en vuelo: el núcleo lee el mensaje y la dirección hasta completar el envío
+typedef struct {
+    struct msghdr hdr;
+    struct iovec iov;
+    struct sockaddr_in addr;
+    uint64_t rx_ns;              // Recepción de la solicitud (para la latencia)
+    dhcp_packet msg;
+} uring_send;
+
+typedef struct {
+    int fd;
+    int sockfd;
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned sq_local_tail;      // SQEs preparadas (se publican al entrar)
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_mem;
+    size_t ring_size;
+    void *sqe_mem;
+    size_t sqe_size;
+    struct io_uring_buf_ring *buf_ring;
+    uint8_t *buffers;            // URING_BUFFERS búferes de URING_BUF_SIZE bytes
+    unsigned short buf_tail;     // Cola local del anillo de búferes
+    struct msghdr recv_hdr;      // Plantilla de la recepción multishot
+    uring_send *sends;
+    int free_sends[URING_SEND_SLOTS];
+    int num_free;
+} uring_io;
+
+static __thread uring_io *tx_uring;  // Anillo del hilo actual (NULL = sin io_uring)
+
+static void uring_free(uring_io *u) {
+    int saved = errno;
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    if (u->ring_mem != NULL && u->ring_mem != MAP_FAILED) {
+        munmap(u->ring_mem, u->ring_size);
+    }
+    if (u->sqe_mem != NULL && u->sqe_mem != MAP_FAILED) {
+        munmap(u->sqe_mem, u->sqe_size);
+    }
+    if (u->buf_ring != NULL && u->buf_ring != MAP_FAILED) {
+        munmap(u->buf_ring, URING_BUFFERS * sizeof(struct io_uring_buf));
+    }
+    free(u->buffers);
+    free(u->sends);
+    errno = saved;
+}
+
+// Devuelve un búfer de recepción al núcleo (visible al publicar la cola)
+static void uring_buf_push(uring_io *u, unsigned short bid) {
+    struct io_uring_buf *buf = &u->buf_ring->bufs[u->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(u->buffers + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    u->buf_tail++;
+}
+
+static void uring_buf_publish(uring_io *u) {
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Crea el anillo y registra los búferes de recepción; devuelve -1 (con errno) si el
+// núcleo no lo admite
+static int uring_setup(uring_io *u, int sockfd) {
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(*u));
+    u->sockfd = sockfd;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = URING_ENTRIES * 8;
+    u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (u->fd < 0 && errno == EINVAL) {
+        // Núcleos anteriores a 6.1: sin emisor único ni trabajo diferido
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = URING_ENTRIES * 8;
+        u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    }
+    if (u->fd < 0) {
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        errno = ENOSYS;
+        uring_free(u);
+        return -1;
+    }
+
+    // Colas de envío y de finalización en una sola proyección, y el vector de SQEs aparte
+    u->ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > u->ring_size) {
+        u->ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    u->ring_mem = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqe_mem = mmap(NULL, u->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->ring_mem == MAP_FAILED || u->sqe_mem == MAP_FAILED) {
+        uring_free(u);
+        return -1;
+    }
+    uint8_t *ring = u->ring_mem;
+    u->sq_head = (unsigned *)(ring + p.sq_off.head);
+    u->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+    u->sq_local_tail = *u->sq_tail;
+    u->sqes = u->sqe_mem;
+    u->cq_head = (unsigned *)(ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+    // Cada posición de la cola apunta siempre a su propia SQE
+    unsigned *array = (unsigned *)(ring + p.sq_off.array);
+    for (unsigned k = 0; k < p.sq_entries; k++) {
+        array[k] = k;
+    }
+
+    // Anillo de búferes proporcionados (grupo URING_BGID)
+    u->buf_ring = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->buffers = aligned_alloc(4096, (size_t)URING_BUFFERS * URING_BUF_SIZE);
+    u->sends = calloc(URING_SEND_SLOTS, sizeof(uring_send));
+    if (u->buf_ring == MAP_FAILED || u->buffers == NULL || u->sends == NULL) {
+        uring_free(u);
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        uring_free(u);
+        return -1;
+    }
+    for (int k = 0; k < URING_BUFFERS; k++) {
+        uring_buf_push(u, k);
+    }
+    uring_buf_publish(u);
+
+    // La recepción solo pide la dirección del remitente, sin datos de control
+    u->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    for (int k = 0; k < URING_SEND_SLOTS; k++) {
+        uring_send *s = &u->sends[k];
+        s->iov.iov_base = &s->msg;
+        s->hdr.msg_name = &s->addr;
+        s->hdr.msg_namelen = sizeof(s->addr);
+        s->hdr.msg_iov = &s->iov;
+        s->hdr.msg_iovlen = 1;
+        u->free_sends[k] = k;
+    }
+    u->num_free = URING_SEND_SLOTS;
+    return 0;
+}
+
+// Publica las SQEs preparadas y espera al menos 'wait' finalizaciones
+static int uring_enter(uring_io *u, unsigned wait) {
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+    unsigned pending = u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    metric_add(&metrics()->rx_calls, 1);
+    return syscall(__NR_io_uring_enter, u->fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// Siguiente SQE libre; si la cola está llena se entregan al núcleo las preparadas
+static struct io_uring_sqe *uring_sqe(uring_io *u) {
+    if (u->sq_local_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > *u->sq_mask) {
+        uring_enter(u, 0);
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_local_tail & *u->sq_mask];
+    u->sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Encola una respuesta como envío del anillo; devuelve -1 si no quedan huecos en vuelo.
+// Los envíos no se enlazan (IOSQE_IO_LINK): un datagrama fallido cancelaría el resto
+static int uring_queue_reply(uring_io *u, const dhcp_packet *response, size_t len, const struct sockaddr_in *client_addr) {
+    if (u->num_free == 0) {
+        return -1;
+    }
+    int k = u->free_sends[--u->num_free];
+    uring_send *s = &u->sends[k];
+    memcpy(&s->msg, response, len);
+    s->iov.iov_len = len;
+    s->addr = *client_addr;
+    s->rx_ns = request_rx_ns;
+
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = u->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&s->hdr;
+    sqe->len = 1;
+    sqe->user_data = ((uint64_t)URING_SEND << 32) | k;
+    return 0;
+}
+
+// Recepción multishot: genera una finalización por datagrama mientras haya búferes
+static void uring_arm_recv(uring_io *u) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = u->sockfd;
+    sqe->addr = (uint64_t)(uintptr_t)&u->recv_hdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (uint64_t)URING_RECV << 32;
+}
+
+// Aviso multishot de que el temporizador de leases ha vencido
+static void uring_arm_timer(uring_io *u, int timerfd) {
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = timerfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t)URING_TIMER << 32;
+}
+
+// Envía todas las respuestas acumuladas en el lote
+void flush_replies(reply_batch *batch) {
+    thread_metrics *m = metrics();
+    int sent = 0;
+    unsigned long calls = 0;
+
+    while (sent < batch->count) {
+        int n = sendmmsg(batch->sockfd, &batch->hdrs[sent], batch->count - sent, 0);
+        calls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error en sendmmsg");
+            break;
+        }
+        sent += n;
+    }
+    uint64_t now = monotonic_ns();
+    for (int i = 0; i < sent; i++) {
+        record_latency(batch->rx_ns[i], now);
+    }
+    metric_add(&m->tx_calls, calls);
+    metric_add(&m->tx_packets, sent);
+    batch->count = 0;
+}
+
+// Envía una respuesta al cliente, directamente, a través del lote del hilo o de su anillo
+void send_reply(int sockfd, const dhcp_packet *response, size_t len, const struct sockaddr_in *client_addr) {
+    reply_batch *batch = tx_batch;
+
+    if (tx_uring != NULL && uring_queue_reply(tx_uring, response, len, client_addr) == 0) {
+        return;
+    }
+    if (batch == NULL) {
+        if (sendto(sockfd, response, len, 0, (const struct sockaddr*)client_addr, sizeof(*client_addr)) < 0) {
+            perror("Error al enviar respuesta");
+        }
+        thread_metrics *m = metrics();
+        record_latency(request_rx_ns, monotonic_ns());
+        metric_add(&m->tx_calls, 1);
+        metric_add(&m->tx_packets, 1);
+        return;
+    }
+
+    if (batch->count > 0 && batch->sockfd != sockfd) {
+        flush_replies(batch);
+    }
+    batch->sockfd = sockfd;
+    memcpy(&batch->msgs[batch->count], response, len);
+    batch->iov[batch->count].iov_len = len;
+    batch->addrs[batch->count] = *client_addr;
+    batch->rx_ns[batch->count] = request_rx_ns;
+    if (++batch->count >= batch_size) {
+        flush_replies(batch);
+    }
+}
+
+static uint32_t record_check(const lease_record *rec) {
+    const uint8_t *bytes = (const uint8_t *)rec;
+    uint32_t hash = 2166136261u;
+    for (size_t k = 0; k < offsetof(lease_record, check); k++) {
+        hash = (hash ^ bytes[k]) * 16777619u;
+    }
+    return hash;
+}
+
+// Toma el estado actual de una entrada como registro del diario
+static void fill_record(pool_config *cfg, long i, lease_record *rec) {
+    ip_entry *e = &cfg->ip_pool[i];
+    entry_snapshot snap = entry_read(e);
+
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = JOURNAL_MAGIC;
+    rec->ip = e->ip_addr;
+    rec->op = snap.state == ENTRY_ASIGNADA ? 1 : 0;
+    rec->mac = snap.mac;
+    rec->expires = snap.expires;
+    rec->check = record_check(rec);
+}
+
+// Aplica un registro recuperado al pool
+static void apply_record(pool_config *cfg, const lease_record *rec, time_t now) {
+    long i = pool_index(cfg, rec->ip);
+    if (i < 0) {  // La dirección ya no pertenece a ningún ámbito
+        return;
+    }
+
+    ip_entry *e = &cfg->ip_pool[i];
+    pool_shard *shard = shard_of(cfg, i);
+    if (rec->op == 1 && rec->expires > now && rec->mac != 0) {
+        if (atomic_load(&e->state) == ENTRY_ASIGNADA) {
+            uint64_t holder = atomic_load(&e->client_mac);
+            if (holder != rec->mac) {
+                mac_index_remove(&cfg->lease_index, holder, i);
+            }
+            entry_set(e, rec->mac, ENTRY_ASIGNADA, rec->expires);
+            if (holder != rec->mac) {
+                mac_index_insert(&cfg->lease_index, rec->mac, i);
+            }
+            wheel_schedule(&shard->timers, i, rec->expires);
+        } else if (peer_owned(rec->ip) || bitmap_claim(&shard->free_map, i - shard->first)) {
+            entry_set(e, rec->mac, ENTRY_ASIGNADA, rec->expires);
+            mac_index_insert(&cfg->lease_index, rec->mac, i);
+            wheel_schedule(&shard->timers, i, rec->expires);
+            metric_leased(1);
+        }
+    } else {
+        uint64_t holder = 0;
+        entry_write_begin(e);
+        int previous = atomic_exchange(&e->state, ENTRY_LIBRE);
+        if (previous == ENTRY_ASIGNADA) {
+            holder = atomic_exchange(&e->client_mac, 0);
+        }
+        entry_write_end(e);
+        if (previous == ENTRY_ASIGNADA) {
+            wheel_cancel(&shard->timers, i);
+            mac_index_remove(&cfg->lease_index, holder, i);
+            if (!peer_owned(rec->ip)) {
+                bitmap_free(&shard->free_map, i - shard->first);
+            }
+            metric_leased(-1);
+        }
+    }
+}
+
+// Proyecta un fichero en memoria de solo lectura; devuelve NULL si no existe o está vacío
+static void *map_file(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    void *data = NULL;
+
+    *size = 0;
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+        } else {
+            *size = st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+// Confirma en disco las entradas del directorio que contiene path (p. ej. un rename)
+static int fsync_parent_dir(const char *path) {
+    char dir[256];
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Escribe una instantánea compacta de los leases vigentes y vacía el diario; devuelve
+// -1 (sin tocar la instantánea anterior ni el diario) si algo falla
+static int journal_snapshot(pool_config *cfg) {
+    char tmp_path[300];
+    snapshot_header header = { SNAPSHOT_MAGIC, 1, 0, time(NULL) };
+    lease_record buffer[1024];
+    int n = 0, ok;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal.snap_path);
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) {
+        perror("No se pudo crear la instantánea de leases");
+        return -1;
+    }
+    ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    for (long i = 0; i < cfg->pool_size; i++) {
+        if (atomic_load(&cfg->ip_pool[i].state) != ENTRY_ASIGNADA) {
+            continue;
+        }
+        fill_record(cfg, i, &buffer[n]);
+        if (buffer[n].op != 1) {
+            continue;
+        }
+        header.count++;
+        if (++n == 1024) {
+            ok = ok && fwrite(buffer, sizeof(lease_record), n, out) == (size_t)n;
+            n = 0;
+        }
+    }
+    ok = ok && fwrite(buffer, sizeof(lease_record), n, out) == (size_t)n;
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = (fclose(out) == 0) && ok;
+
+    // Una instantánea incompleta (disco lleno, error de E/S) no sustituye a la anterior
+    // ni vacía el diario: ambos siguen describiendo todos los leases
+    if (!ok) {
+        perror("Error al escribir la instantánea de leases");
+        unlink(tmp_path);
+        return -1;
+    }
+    // El cambio de nombre es atómico: tras un fallo queda la instantánea anterior o la nueva
+    if (rename(tmp_path, journal.snap_path) != 0) {
+        perror("No se pudo instalar la instantánea de leases");
+        unlink(tmp_path);
+        return -1;
+    }
+    // El diario solo se vacía cuando el cambio de nombre ya es persistente
+    if (fsync_parent_dir(journal.snap_path) != 0) {
+        perror("No se pudo confirmar el directorio de la instantánea");
+        return -1;
+    }
+    // Si el diario no queda vacío de forma persistente conserva su cuenta de registros,
+    // y la compactación se repite en la próxima escritura
+    if (ftruncate(journal.fd, 0) != 0 || fdatasync(journal.fd) != 0) {
+        perror("No se pudo vaciar el diario de leases");
+        return -1;
+    }
+    lseek(journal.fd, 0, SEEK_SET);
+    journal.records = 0;
+    return 0;
+}
+
+// Añade registros completos al diario; una escritura parcial se continúa. Si falla,
+// el diario se recorta al último registro entero para que la reproducción no se
+// detenga en un registro roto
+static int journal_append(const lease_record *records, int n) {
+    const char *data = (const char *)records;
+    size_t len = n * sizeof(lease_record), done = 0;
+    off_t start = lseek(journal.fd, 0, SEEK_END);
+
+    while (done < len) {
+        ssize_t w = write(journal.fd, data + done, len - done);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            perror("Error al escribir el diario de leases");
+            if (start >= 0 && ftruncate(journal.fd, start) != 0) {
+                perror("No se pudo recortar el diario de leases");
+            }
+            return -1;
+        }
+        done += w;
+    }
+    return 0;
+}
+
+// Escribe los cambios pendientes al diario con un único fsync; devuelve los registros
+// confirmados. El estado se lee de la configuración activa (el escritor es un lector más).
+static long journal_flush(pool_config *cfg) {
+    lease_record buffer[1024];
+    unsigned int ip;
+    long written = 0;
+    int n = 0, failed = 0;
+
+    if (atomic_exchange(&journal.overflow, 0)) {
+        while (ring_pop(&journal.pending, &ip) == 0)
+            ;
+        // Si la instantánea falla se vuelve a intentar en la próxima escritura
+        if (journal_snapshot(cfg) != 0) {
+            atomic_store(&journal.overflow, 1);
+        }
+        return 1;
+    }
+
+    while (ring_pop(&journal.pending, &ip) == 0) {
+        long i = pool_index(cfg, ip);
+        if (i < 0) {
+            continue;  // La dirección salió de la configuración al recargarla
+        }
+        fill_record(cfg, i, &buffer[n++]);
+        if (n == 1024) {
+            if (journal_append(buffer, n) != 0) {
+                failed = 1;
+            } else {
+                written += n;
+            }
+            n = 0;
+        }
+    }
+    if (n > 0) {
+        if (journal_append(buffer, n) != 0) {
+            failed = 1;
+        } else {
+            written += n;
+        }
+    }
+    // Registros escritos pero sin fsync confirmado pueden no ser persistentes: como los
+    // que no llegaron al diario, solo se recuperan con una instantánea completa
+    if (written > 0 && fdatasync(journal.fd) != 0) {
+        perror("Error al confirmar el diario de leases");
+        failed = 1;
+        written = 0;
+    }
+    if (failed) {
+        atomic_store(&journal.overflow, 1);
+    }
+    journal.records += written;
+
+    // Compactación periódica: el diario no crece más allá del doble del pool
+    if (journal.records > 2L * cfg->pool_size + 4096) {
+        journal_snapshot(cfg);
+    }
+    return written;
+}
+
+// Hilo escritor: duerme hasta que hay cambios, espera una ventana corta para agruparlos y confirma
+void* journal_thread(void* arg) {
+    (void)arg;
+    struct timespec window = { 0, COMMIT_WINDOW_US * 1000L };
+
+    while (running) {
+        atomic_store(&journal.sleeping, 1);
+        long written = journal_flush(config_enter());
+        config_exit();
+        if (written == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            sem_timedwait(&journal.wake, &deadline);
+        }
+        atomic_store(&journal.sleeping, 0);
+        nanosleep(&window, NULL);
+    }
+    journal_flush(config_enter());
+    config_exit();
+    return NULL;
+}
+
+// Recupera el estado persistido: instantánea proyectada en memoria y reproducción del diario
+void journal_recover(pool_config *cfg) {
+    time_t now = time(NULL);
+    struct timespec t0, t1;
+    size_t size;
+    long restored = 0, replayed = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    snapshot_header *header = map_file(journal.snap_path, &size);
+    if (header != NULL) {
+        if (size >= sizeof(*header) && header->magic == SNAPSHOT_MAGIC &&
+            sizeof(*header) + header->count * sizeof(lease_record) <= size) {
+            const lease_record *rec = (const lease_record *)(header + 1);
+            for (uint64_t k = 0; k < header->count; k++) {
+                if (rec[k].check == record_check(&rec[k])) {
+                    apply_record(cfg, &rec[k], now);
+                    restored++;
+                }
+            }
+        } else {
+            LOG(LOG_WARN, "Instantánea de leases %s inválida, se ignora", journal.snap_path);
+        }
+        munmap(header, size);
+    }
+
+    const lease_record *rec = map_file(journal.journal_path, &size);
+    size_t valid = 0;
+    if (rec != NULL) {
+        // La reproducción se detiene en el primer registro roto (escritura interrumpida)
+        for (size_t k = 0; k < size / sizeof(lease_record); k++) {
+            if (rec[k].magic != JOURNAL_MAGIC || rec[k].check != record_check(&rec[k])) {
+                break;
+            }
+            apply_record(cfg, &rec[k], now);
+            valid += sizeof(lease_record);
+            replayed++;
+        }
+        munmap((void *)rec, size);
+    }
+    if (valid < size) {
+        LOG(LOG_WARN, "Diario de leases truncado en %zu bytes", valid);
+        if (truncate(journal.journal_path, valid) != 0) {
+            perror("No se pudo truncar el diario de leases");
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    LOG(LOG_INFO, "Leases recuperados: %ld de la instantánea y %ld del diario en %.1f ms", restored, replayed,
+        (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+}
+
+// Abre el diario, recupera el estado anterior y arranca el escritor
+void journal_start(const char *prefix) {
+    snprintf(journal.snap_path, sizeof(journal.snap_path), "%s.snap", prefix);
+    snprintf(journal.journal_path, sizeof(journal.journal_path), "%s.journal", prefix);
+
+    // Aún no hay otros hilos: la configuración inicial se usa directamente
+    pool_config *cfg = atomic_load(&active_config);
+    journal_recover(cfg);
+
+    journal.fd = open(journal.journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal.fd < 0) {
+        perror("No se pudo abrir el diario de leases");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    while (capacity < (size_t)cfg->pool_size && capacity < (1u << 20)) {
+        capacity <<= 1;
+    }
+    ring_init(&journal.pending, capacity);
+    sem_init(&journal.wake, 0, 0);
+    journal.enabled = 1;
+
+    // Instantánea inicial: el diario arranca vacío sobre el estado recuperado
+    journal_snapshot(cfg);
+
+    // Las señales de fin no deben interrumpir al escritor
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (pthread_create(&journal.thread, NULL, journal_thread, NULL) != 0) {
+        perror("Error al crear el hilo del diario");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// Detiene el escritor tras confirmar los cambios pendientes
+void journal_stop(void) {
+    if (!journal.enabled) {
+        return;
+    }
+    sem_post(&journal.wake);
+    pthread_join(journal.thread, NULL);
+    close(journal.fd);
+}
+
+// El otro servidor del par ha dado señales de vida recientemente
+static inline int ha_peer_up(void) {
+    return time(NULL) - atomic_load_explicit(&ha.peer_seen, memory_order_relaxed) <= REPLICA_PEER_TIMEOUT;
+}
+
+// Cada servidor del par responde a los DHCPDISCOVER de la mitad de los clientes, por el
+// hash de la MAC (como en RFC 3074), salvo que el otro haya caído. Un cliente con lease
+// lo atiende el dueño de su dirección para que no cambie de IP. Los que llegan por un
+// relay (giaddr) se atienden siempre: el relay los envía a un solo servidor, elegido con
+// su propio hash, y el otro no los recibe
+static int ha_serves(pool_config *cfg, dhcp_scope *scope, uint64_t mac, uint32_t giaddr) {
+    if (!ha.enabled || !ha_peer_up() || giaddr != 0) {
+        return 1;
+    }
+    long i = mac_index_lookup(&cfg->lease_index, mac, scope->first, scope->first + scope->count);
+    if (i >= 0) {
+        return !peer_owned(cfg->ip_pool[i].ip_addr);
+    }
+    return (int)(mac_hash(mac) >> 63) == ha.role;
+}
+
+static void replica_send(const void *data, size_t len) {
+    // Un datagrama perdido se recupera con el reenvío de la ventana
+    sendto(ha.sockfd, data, len, 0, (struct sockaddr *)&ha.peer, sizeof(ha.peer));
+}
+
+static void replica_send_batch(uint64_t seq) {
+    replica_batch *batch = &ha.window[seq % REPLICA_WINDOW];
+    replica_send(batch, sizeof(replica_header) + batch->header.count * sizeof(lease_record));
+}
+
+// Confirma el último lote aplicado en orden; sirve también de latido
+static void replica_send_ack(void) {
+    replica_header ack = { REPLICA_MAGIC, REPLICA_ACK, 0, ha.peer_session, ha.expected - 1 };
+    replica_send(&ack, sizeof(ack));
+    ha.ack_ns = monotonic_ns();
+}
+
+// Descarta la ventana y empieza a enviar el estado completo, que el otro servidor
+// reconoce por el lote REPLICA_RESET con que empieza
+static void replica_start_resync(pool_config *cfg) {
+    ha.acked = ha.next_seq - 1;
+    ha.reset_seq = ha.next_seq;
+    ha.resync = 0;
+    ha.resync_generation = cfg->generation;
+    atomic_fetch_add_explicit(&ha.resyncs, 1, memory_order_relaxed);
+}
+
+// Llena un lote: primero el estado completo en curso y después los cambios pendientes
+static int replica_fill(pool_config *cfg, replica_batch *batch) {
+    unsigned int ip;
+    int n = 0;
+
+    if (ha.resync >= 0 && ha.resync_generation != cfg->generation) {
+        ha.resync = 0;  // Una recarga cambió los índices del pool
+        ha.resync_generation = cfg->generation;
+    }
+    while (n < REPLICA_BATCH && ha.resync >= 0) {
+        long i = ha.resync++;
+        if (i >= cfg->pool_size) {
+            ha.resync = -1;
+            break;
+        }
+        // Las ofertas no se replican; las entradas que nunca tuvieron lease no aportan nada
+        if (atomic_load(&cfg->ip_pool[i].state) == ENTRY_OFRECIDA) {
+            continue;
+        }
+        fill_record(cfg, i, &batch->records[n]);
+        n += batch->records[n].expires != 0;
+    }
+    while (n < REPLICA_BATCH && ha.resync < 0 && ring_pop(&ha.pending, &ip) == 0) {
+        long i = pool_index(cfg, ip);
+        if (i >= 0) {
+            fill_record(cfg, i, &batch->records[n++]);
+        }
+    }
+    return n;
+}
+
+// Envía lotes nuevos mientras quepan en la ventana
+static void replica_flush(pool_config *cfg) {
+    unsigned int ip;
+
+    if (atomic_exchange(&ha.overflow, 0)) {
+        while (ring_pop(&ha.pending, &ip) == 0)
+            ;
+        LOG(LOG_WARN, "Cola de replicación desbordada: se enviará el estado completo");
+        replica_start_resync(cfg);
+    }
+    while (ha.next_seq - ha.acked <= REPLICA_WINDOW) {
+        uint64_t seq = ha.next_seq;
+        replica_batch *batch = &ha.window[seq % REPLICA_WINDOW];
+        int n = replica_fill(cfg, batch);
+        if (n == 0 && seq != ha.reset_seq) {
+            break;
+        }
+        batch->header = (replica_header){ REPLICA_MAGIC, seq == ha.reset_seq ? REPLICA_RESET : REPLICA_UPDATE, n,
+                                          ha.session, seq };
+        if (seq == ha.acked + 1) {
+            ha.retry_ns = monotonic_ns();
+        }
+        replica_send_batch(seq);
+        ha.next_seq++;
+        atomic_fetch_add_explicit(&ha.records_sent, n, memory_order_relaxed);
+    }
+}
+
+// Aplica un registro del otro servidor y lo persiste. Prevalece el estado con la
+// expiración más tardía: un registro antiguo no deshace un lease renovado aquí
+static void replica_apply(pool_config *cfg, const lease_record *rec, time_t now) {
+    lease_record local;
+    long i = pool_index(cfg, rec->ip);
+
+    if (i < 0 || rec->check != record_check(rec) || atomic_load(&cfg->ip_pool[i].state) == ENTRY_OFRECIDA) {
+        return;
+    }
+    fill_record(cfg, i, &local);
+    if (local.expires > rec->expires) {
+        return;
+    }
+    apply_record(cfg, rec, now);
+    journal_note(rec->ip);
+    atomic_fetch_add_explicit(&ha.records_applied, 1, memory_order_relaxed);
+}
+
+// Atiende los datagramas del otro servidor: lotes (que se aplican solo en orden) y
+// confirmaciones de los nuestros
+static void replica_receive(pool_config *cfg) {
+    replica_batch batch;
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int ack_due = 0;
+    ssize_t len;
+
+    while ((len = recvfrom(ha.sockfd, &batch, sizeof(batch), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len)) >= 0) {
+        const replica_header *h = &batch.header;
+        from_len = sizeof(from);
+        if ((size_t)len < sizeof(*h) || h->magic != REPLICA_MAGIC || from.sin_addr.s_addr != ha.peer.sin_addr.s_addr ||
+            from.sin_port != ha.peer.sin_port) {
+            continue;
+        }
+        atomic_store(&ha.peer_seen, time(NULL));
+
+        if (h->type == REPLICA_ACK) {
+            if (h->session != ha.session) {
+                // El otro servidor no conoce este arranque (acaba de arrancar él o nosotros)
+                if (ha.resync < 0 && ha.acked >= ha.reset_seq) {
+                    LOG(LOG_INFO, "El otro servidor del par no tiene nuestro estado: se le envía completo");
+                    replica_start_resync(cfg);
+                }
+            } else if (h->seq > ha.acked && h->seq < ha.next_seq) {
+                ha.acked = h->seq;
+                ha.retry_ns = monotonic_ns();
+            }
+            continue;
+        }
+        if (h->count > REPLICA_BATCH || (size_t)len < sizeof(*h) + h->count * sizeof(lease_record)) {
+            continue;
+        }
+        // Un estado completo reinicia la numeración salvo que sea el reenvío de uno ya aplicado
+        if (h->type == REPLICA_RESET && (h->session != ha.peer_session || h->seq >= ha.expected)) {
+            if (h->session != ha.peer_session) {
+                LOG(LOG_INFO, "Recibiendo el estado completo del otro servidor del par");
+            }
+            ha.peer_session = h->session;
+            ha.expected = h->seq;
+        }
+        if (h->session == ha.peer_session && h->seq == ha.expected) {
+            time_t now = time(NULL);
+            for (int k = 0; k < h->count; k++) {
+                replica_apply(cfg, &batch.records[k], now);
+            }
+            ha.expected++;
+        }
+        ack_due = 1;
+    }
+    if (ack_due) {
+        replica_send_ack();
+    }
+}
+
+// Hilo de replicación: envía los cambios por lotes, reenvía los que no se confirman,
+// aplica los del otro servidor y avisa cuando este aparece o deja de responder
+void* replica_thread(void* arg) {
+    (void)arg;
+    struct timespec window = { 0, REPLICA_DELAY_US * 1000L };
+    struct pollfd fds[2] = { { ha.sockfd, POLLIN, 0 }, { ha.wake_fd, POLLIN, 0 } };
+    int peer_was_up = 0;
+
+    while (running) {
+        atomic_store(&ha.sleeping, 1);
+        pool_config *cfg = config_enter();
+        replica_receive(cfg);
+        replica_flush(cfg);
+        config_exit();
+
+        uint64_t now = monotonic_ns();
+        int inflight = ha.acked + 1 < ha.next_seq;
+        if (inflight && now - ha.retry_ns >= REPLICA_RETRY_MS * 1000000ULL) {
+            // Con el otro servidor caído solo se sondea con el lote más antiguo
+            uint64_t last = ha_peer_up() ? ha.next_seq : ha.acked + 2;
+            for (uint64_t seq = ha.acked + 1; seq < last; seq++) {
+                replica_send_batch(seq);
+                atomic_fetch_add_explicit(&ha.retransmits, 1, memory_order_relaxed);
+            }
+            ha.retry_ns = now;
+        }
+        if (now - ha.ack_ns >= REPLICA_HEARTBEAT_MS * 1000000ULL) {
+            replica_send_ack();
+        }
+
+        int up = ha_peer_up();
+        if (up != peer_was_up) {
+            if (up) {
+                LOG(LOG_INFO, "Otro servidor del par conectado");
+            } else {
+                LOG(LOG_WARN, "El otro servidor del par no responde: se atienden todos los clientes");
+            }
+            peer_was_up = up;
+        }
+
+        if (poll(fds, 2, inflight ? REPLICA_RETRY_MS : REPLICA_HEARTBEAT_MS) > 0 && (fds[1].revents & POLLIN)) {
+            uint64_t count;
+            if (read(ha.wake_fd, &count, sizeof(count)) > 0) {
+                nanosleep(&window, NULL);
+            }
+        }
+        atomic_store(&ha.sleeping, 0);
+    }
+
+    // Último envío de los cambios pendientes, sin esperar su confirmación
+    replica_flush(config_enter());
+    config_exit();
+    return NULL;
+}
+
+// Abre el canal con el otro servidor del par y arranca el hilo de replicación, que
+// empieza enviándole el estado completo
+void replica_start(void) {
+    struct sockaddr_in local;
+    struct timespec ts;
+
+    if ((ha.sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("No se pudo crear el socket de replicación");
+        exit(EXIT_FAILURE);
+    }
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr = listen_addr;
+    local.sin_port = ha.peer.sin_port;
+    if (bind(ha.sockfd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("No se pudo enlazar el socket de replicación");
+        exit(EXIT_FAILURE);
+    }
+    if ((ha.wake_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("No se pudo crear el eventfd de replicación");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    pool_config *cfg = atomic_load(&active_config);
+    while (capacity < (size_t)cfg->pool_size && capacity < (1u << 20)) {
+        capacity <<= 1;
+    }
+    ring_init(&ha.pending, capacity);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ha.session = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    ha.next_seq = 1;
+    ha.expected = 1;
+    replica_start_resync(cfg);
+    atomic_store(&ha.resyncs, 0);
+
+    // Las señales de fin no deben interrumpir al hilo de replicación
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (pthread_create(&ha.thread, NULL, replica_thread, NULL) != 0) {
+        perror("Error al crear el hilo de replicación");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    LOG(LOG_INFO, "Par HA: rol %d (IPs %s), replicación con %I puerto %d", ha.role, ha.role ? "impares" : "pares",
+        ntohl(ha.peer.sin_addr.s_addr), ntohs(ha.peer.sin_port));
+}
+
+// Detiene el hilo de replicación tras enviar los cambios pendientes
+void replica_stop(void) {
+    if (!ha.enabled) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(ha.wake_fd, &one, sizeof(one)) < 0) {
+        perror("Error al despertar el hilo de replicación");
+    }
+    pthread_join(ha.thread, NULL);
+    close(ha.sockfd);
+    close(ha.wake_fd);
+}
+
+// Añade una opción TLV a la plantilla; devuelve la posición del valor o -1 si no cabe
+int template_add_option(option_template *tpl, uint8_t code, uint8_t len, const void *data) {
+    // Se reserva un byte para la opción de fin
+    if (tpl->length + 2 + len + 1 > OPTIONS_SIZE) {
+        fprintf(stderr, "La opción %d no cabe en el bloque de opciones\n", code);
+        return -1;
+    }
+    tpl->bytes[tpl->length++] = code;
+    tpl->bytes[tpl->length++] = len;
+    if (len > 0) {
+        memcpy(&tpl->bytes[tpl->length], data, len);
+    }
+    tpl->length += len;
+    return tpl->length - len;
+}
+
+// Añade una opción con una lista de IPv4 separadas por comas; devuelve -1 si la lista
+// está vacía, tiene direcciones inválidas o pasa de las 63 que caben en una opción
+int template_add_ipv4_list(option_template *tpl, uint8_t code, const char *list) {
+    uint8_t data[252];
+    int len = 0;
+    char copy[1024];
+    char *save;
+
+    if (snprintf(copy, sizeof(copy), "%s", list) >= (int)sizeof(copy)) {
+        fprintf(stderr, "Lista demasiado larga en la opción %d\n", code);
+        return -1;
+    }
+    for (char *tok = strtok_r(copy, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+        if (len + 4 > (int)sizeof(data)) {
+            fprintf(stderr, "La opción %d admite como mucho %zu direcciones\n", code, sizeof(data) / 4);
+            return -1;
+        }
+        if (inet_pton(AF_INET, tok, &data[len]) != 1) {
+            fprintf(stderr, "Dirección inválida en la opción %d: %s\n", code, tok);
+            return -1;
+        }
+        len += 4;
+    }
+    if (len == 0) {
+        fprintf(stderr, "La opción %d no tiene ninguna dirección\n", code);
+        return -1;
+    }
+    return template_add_option(tpl, code, len, data);
+}
+
+// Añade la opción 121 (rutas sin clase, RFC 3442) a partir de "red/prefijo:puerta,..."
+int template_add_classless_routes(option_template *tpl, const char *routes) {
+    uint8_t data[255];
+    int len = 0;
+    char copy[1024];
+    char *save;
+
+    if (snprintf(copy, sizeof(copy), "%s", routes) >= (int)sizeof(copy)) {
+        fprintf(stderr, "Lista de rutas demasiado larga\n");
+        return -1;
+    }
+    for (char *tok = strtok_r(copy, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+        char *slash = strchr(tok, '/');
+        char *colon = strchr(tok, ':');
+        uint8_t dest[4], gateway[4];
+        if (slash == NULL || colon == NULL || colon < slash) {
+            fprintf(stderr, "Ruta inválida: %s\n", tok);
+            return -1;
+        }
+        *slash = '\0';
+        *colon = '\0';
+        int prefix = atoi(slash + 1);
+        int significant = (prefix + 7) / 8;
+        if (prefix < 0 || prefix > 32 || inet_pton(AF_INET, tok, dest) != 1 || inet_pton(AF_INET, colon + 1, gateway) != 1 ||
+            len + 1 + significant + 4 > 255) {
+            fprintf(stderr, "Ruta inválida: %s\n", tok);
+            return -1;
+        }
+        data[len++] = prefix;
+        memcpy(&data[len], dest, significant);
+        len += significant;
+        memcpy(&data[len], gateway, 4);
+        len += 4;
+    }
+    return len > 0 ? template_add_option(tpl, 121, len, data) : -1;
+}
+
+// Codifica una vez el bloque de opciones de un pool. Las opciones vacías no se envían;
+// devuelve -1 si algún valor es inválido o no cabe, y el ámbito se rechaza entero
+int compile_option_template(option_template *tpl, const char* subnet_mask, const char* gateway, const char* dns,
+                            const char* domain, int lease_time, const char *ntp, const char *routes) {
+    uint8_t type = 0;
+    uint32_t lease = htonl(lease_time);
+
+    memset(tpl, 0, sizeof(*tpl));
+    tpl->type_offset = template_add_option(tpl, 53, 1, &type);
+    if (tpl->type_offset < 0 || template_add_option(tpl, 54, 4, &server_id) < 0 ||
+        template_add_ipv4_list(tpl, 1, subnet_mask) < 0) {
+        return -1;
+    }
+    if ((gateway[0] != '\0' && template_add_ipv4_list(tpl, 3, gateway) < 0) ||
+        (dns[0] != '\0' && template_add_ipv4_list(tpl, 6, dns) < 0)) {
+        return -1;
+    }
+    if (strlen(domain) > 255) {
+        fprintf(stderr, "Nombre de dominio demasiado largo: %s\n", domain);
+        return -1;
+    }
+    if (domain[0] != '\0' && template_add_option(tpl, 15, strlen(domain), domain) < 0) {
+        return -1;
+    }
+    tpl->lease_offset = template_add_option(tpl, 51, 4, &lease);
+    if (tpl->lease_offset < 0) {
+        return -1;
+    }
+    if ((ntp != NULL && ntp[0] != '\0' && template_add_ipv4_list(tpl, 42, ntp) < 0) ||
+        (routes != NULL && routes[0] != '\0' && template_add_classless_routes(tpl, routes) < 0)) {
+        return -1;
+    }
+    tpl->bytes[tpl->length++] = 255; // Fin de las opciones
+    return 0;
+}
+
+// Registra un ámbito y compila sus opciones; las IPs van en orden de host. Devuelve -1
+// si el rango o alguna de sus opciones es inválido
+int scope_add(pool_config *cfg, uint32_t network, int prefix_len, uint32_t start, uint32_t end, const char *mask,
+              const char *router, const char *dns, const char *domain, int lease_time, const char *ntp,
+              const char *routes) {
+    if (prefix_len < 0 || prefix_len > 32 || start > end || lease_time <= 0 ||
+        (start & prefix_mask(prefix_len)) != network || (end & prefix_mask(prefix_len)) != network) {
+        return -1;
+    }
+    if (cfg->num_scopes == cfg->scope_capacity) {
+        cfg->scope_capacity = cfg->scope_capacity ? cfg->scope_capacity * 2 : 16;
+        cfg->scopes = realloc(cfg->scopes, cfg->scope_capacity * sizeof(dhcp_scope));
+        if (cfg->scopes == NULL) {
+            perror("Error al asignar memoria para los ámbitos");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Las opciones se compilan antes de publicar el prefijo: un ámbito rechazado no deja
+    // rastro en el árbol
+    dhcp_scope *scope = &cfg->scopes[cfg->num_scopes];
+    memset(scope, 0, sizeof(*scope));
+    scope->network = network;
+    scope->prefix_len = prefix_len;
+    scope->range_start = start;
+    scope->range_end = end;
+    scope->count = (long)end - start + 1;
+    scope->lease_time = lease_time;
+    if (compile_option_template(&scope->options, mask, router, dns, domain, lease_time, ntp, routes) < 0 ||
+        lpm_insert(&cfg->trie, network, prefix_len, cfg->num_scopes) < 0) {
+        return -1;
+    }
+    return cfg->num_scopes++;
+}
+
+// Anota un rango de direcciones que no se asignará
+static void exclusion_add(pool_config *cfg, uint32_t first, uint32_t last) {
+    if (cfg->num_exclusions == cfg->exclusion_capacity) {
+        cfg->exclusion_capacity = cfg->exclusion_capacity ? cfg->exclusion_capacity * 2 : 16;
+        cfg->exclusions = realloc(cfg->exclusions, cfg->exclusion_capacity * sizeof(ip_range));
+        if (cfg->exclusions == NULL) {
+            perror("Error al asignar memoria para las exclusiones");
+            exit(EXIT_FAILURE);
+        }
+    }
+    cfg->exclusions[cfg->num_exclusions++] = (ip_range){ first, last };
+}
+
+// Carga un fichero de configuración; cada línea es un ámbito o una exclusión:
+//   red/prefijo inicio fin [router=IP] [dns=IP] [dominio=nombre] [lease=s] [ntp=IP,...] [rutas=...] [defecto]
+//   excluir IP[-IP]
+// Las líneas vacías y las que empiezan por '#' se ignoran. Devuelve -1 si hay errores.
+int load_config(pool_config *cfg, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[1024];
+    int lineno = 0;
+
+    if (file == NULL) {
+        perror("Error al abrir el fichero de configuración");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *save, *net, *first, *last, *token;
+        const char *router = "", *dns = "", *domain = "", *ntp = "", *routes = "";
+        int lease_time = LEASE_TIME, is_default = 0, prefix_len;
+        struct in_addr network, start, end, mask;
+        char mask_str[INET_ADDRSTRLEN];
+
+        lineno++;
+        net = strtok_r(line, " \t\r\n", &save);
+        if (net == NULL || net[0] == '#') {
+            continue;
+        }
+        first = strtok_r(NULL, " \t\r\n", &save);
+
+        if (strcmp(net, "excluir") == 0) {
+            char *dash = first != NULL ? strchr(first, '-') : NULL;
+            if (dash != NULL) {
+                *dash = '\0';
+            }
+            if (first == NULL || inet_pton(AF_INET, first, &start) != 1 ||
+                inet_pton(AF_INET, dash != NULL ? dash + 1 : first, &end) != 1 ||
+                ntohl(start.s_addr) > ntohl(end.s_addr) || strtok_r(NULL, " \t\r\n", &save) != NULL) {
+                goto invalid;
+            }
+            exclusion_add(cfg, ntohl(start.s_addr), ntohl(end.s_addr));
+            continue;
+        }
+
+        last = strtok_r(NULL, " \t\r\n", &save);
+        char *slash = strchr(net, '/');
+        if (slash == NULL || first == NULL || last == NULL) {
+            goto invalid;
+        }
+        *slash = '\0';
+        prefix_len = atoi(slash + 1);
+        if (inet_pton(AF_INET, net, &network) != 1 || inet_pton(AF_INET, first, &start) != 1 ||
+            inet_pton(AF_INET, last, &end) != 1 || prefix_len < 0 || prefix_len > 32) {
+            goto invalid;
+        }
+        while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+            if (strncmp(token, "router=", 7) == 0) {
+                router = token + 7;
+            } else if (strncmp(token, "dns=", 4) == 0) {
+                dns = token + 4;
+            } else if (strncmp(token, "dominio=", 8) == 0) {
+                domain = token + 8;
+            } else if (strncmp(token, "lease=", 6) == 0) {
+                lease_time = atoi(token + 6);
+            } else if (strncmp(token, "ntp=", 4) == 0) {
+                ntp = token + 4;
+            } else if (strncmp(token, "rutas=", 6) == 0) {
+                routes = token + 6;
+            } else if (strcmp(token, "defecto") == 0) {
+                is_default = 1;
+            } else {
+                goto invalid;
+            }
+        }
+
+        mask.s_addr = htonl(prefix_mask(prefix_len));
+        inet_ntop(AF_INET, &mask, mask_str, sizeof(mask_str));
+        int s = scope_add(cfg, ntohl(network.s_addr) & prefix_mask(prefix_len), prefix_len, ntohl(start.s_addr),
+                          ntohl(end.s_addr), mask_str, router, dns, domain, lease_time, ntp, routes);
+        if (s < 0) {
+            goto invalid;
+        }
+        if (is_default) {
+            cfg->default_scope = s;
+        }
+        continue;
+
+    invalid:
+        fprintf(stderr, "%s:%d: ámbito o exclusión inválidos o duplicados\n", path, lineno);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+// Posición en [0, n) de un hash de 64 bits, sin división
+static inline size_t hash_reduce(uint64_t hash, size_t n) {
+    return (size_t)(((hash >> 32) * (uint64_t)n) >> 32);
+}
+
+static inline size_t reservation_bucket(const reservation_table *table, uint64_t mac) {
+    return hash_reduce(mac_hash(mac ^ table->salt), table->nbuckets);
+}
+
+static inline size_t reservation_slot(const reservation_table *table, uint64_t mac, uint32_t seed) {
+    return hash_reduce(mac_hash(mac ^ table->salt ^ ((uint64_t)(seed + 1) * 0x9e3779b97f4a7c15ULL)), table->count);
+}
+
+// Posición de la reserva de la MAC, sea cual sea su ámbito; -1 si no tiene ninguna
+static long reservation_find(const reservation_table *table, uint64_t mac) {
+    if (table->count == 0) {
+        return -1;
+    }
+    size_t k = reservation_slot(table, mac, table->seeds[reservation_bucket(table, mac)]);
+    return (table->keys[k] & ((1ULL << 48) - 1)) == mac ? (long)k : -1;
+}
+
+// IP reservada para la MAC en el ámbito indicado; devuelve 0 si no tiene ninguna allí
+static int reservation_lookup(const reservation_table *table, uint64_t mac, int scope, uint32_t *ip) {
+    long k = reservation_find(table, mac);
+    if (k < 0 || table->keys[k] >> 48 != (uint64_t)scope) {
+        return 0;
+    }
+    *ip = table->ips[k];
+    return 1;
+}
+
+// Posición de la reserva de la IP (orden de host) por búsqueda binaria; -1 si no está
+// reservada
+static long reservation_find_ip(const reservation_table *table, uint32_t ip) {
+    size_t lo = 0, hi = table->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (table->ips[table->by_ip[mid]] < ip) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < table->count && table->ips[table->by_ip[lo]] == ip ? (long)table->by_ip[lo] : -1;
+}
+
+// Anota una reserva leída del fichero; se compila con las demás al final
+static void reservation_add(reservation_table *table, uint64_t mac, uint32_t ip) {
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 1024;
+        table->keys = realloc(table->keys, table->capacity * sizeof(uint64_t));
+        table->ips = realloc(table->ips, table->capacity * sizeof(uint32_t));
+        if (table->keys == NULL || table->ips == NULL) {
+            perror("Error al asignar memoria para las reservas");
+            exit(EXIT_FAILURE);
+        }
+    }
+    table->keys[table->count] = mac;
+    table->ips[table->count++] = ip;
+}
+
+// Intenta colocar todas las claves con la semilla global actual. Los grupos se
+// procesan de mayor a menor, cuando aún hay sitio para los grandes; cada uno prueba
+// semillas hasta que todas sus claves caen en posiciones libres y distintas.
+// Devuelve -1 si algún grupo agota RESERVATION_MAX_TRIES
+static int reservation_place(reservation_table *table, const uint64_t *macs, const uint32_t *ips,
+                             uint64_t *keys, uint32_t *placed_ips) {
+    size_t n = table->count, nb = table->nbuckets;
+    size_t *start = calloc(nb + 1, sizeof(size_t));
+    size_t *members = malloc(n * sizeof(size_t));
+    size_t *order = calloc(nb, sizeof(size_t));
+    size_t *by_size = calloc(RESERVATION_MAX_GROUP + 2, sizeof(size_t));
+    uint8_t *taken = calloc(n, 1);
+    size_t slots[RESERVATION_MAX_GROUP];
+    int result = 0;
+
+    if (start == NULL || members == NULL || order == NULL || by_size == NULL || taken == NULL) {
+        perror("Error al asignar memoria para compilar las reservas");
+        exit(EXIT_FAILURE);
+    }
+
+    // Claves agrupadas por grupo (ordenación por cuentas)
+    for (size_t k = 0; k < n; k++) {
+        start[reservation_bucket(table, macs[k]) + 1]++;
+    }
+    for (size_t b = 0; b < nb; b++) {
+        if (start[b + 1] > RESERVATION_MAX_GROUP) {
+            result = -1;  // Grupo demasiado grande: se prueba otra semilla global
+            goto done;
+        }
+        start[b + 1] += start[b];
+    }
+    for (size_t k = 0; k < n; k++) {
+        size_t b = reservation_bucket(table, macs[k]);
+        members[start[b] + order[b]++] = k;  // order cuenta de momento las claves ya repartidas
+    }
+
+    // Grupos de mayor a menor tamaño
+    for (size_t b = 0; b < nb; b++) {
+        by_size[RESERVATION_MAX_GROUP - (start[b + 1] - start[b]) + 1]++;
+    }
+    for (int s = 1; s <= RESERVATION_MAX_GROUP + 1; s++) {
+        by_size[s] += by_size[s - 1];
+    }
+    for (size_t b = 0; b < nb; b++) {
+        order[by_size[RESERVATION_MAX_GROUP - (start[b + 1] - start[b])]++] = b;
+    }
+
+    for (size_t o = 0; o < nb; o++) {
+        size_t b = order[o], size = start[b + 1] - start[b];
+        if (size == 0) {
+            table->seeds[b] = 0;
+            continue;
+        }
+        uint32_t seed;
+        for (seed = 0; seed < RESERVATION_MAX_TRIES; seed++) {
+            size_t j;
+            for (j = 0; j < size; j++) {
+                slots[j] = reservation_slot(table, macs[members[start[b] + j]], seed);
+                if (taken[slots[j]]) {
+                    break;
+                }
+                size_t p;
+                for (p = 0; p < j && slots[p] != slots[j]; p++)
+                    ;
+                if (p < j) {
+                    break;
+                }
+            }
+            if (j == size) {
+                break;
+            }
+        }
+        if (seed == RESERVATION_MAX_TRIES) {
+            result = -1;
+            goto done;
+        }
+        table->seeds[b] = seed;
+        for (size_t j = 0; j < size; j++) {
+            size_t k = members[start[b] + j];
+            taken[slots[j]] = 1;
+            keys[slots[j]] = macs[k];
+            placed_ips[slots[j]] = ips[k];
+        }
+    }
+
+done:
+    free(start);
+    free(members);
+    free(order);
+    free(by_size);
+    free(taken);
+    return result;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Compila las reservas cargadas en el hash perfecto mínimo. Cada MAC lleva en los 16
+// bits altos de su clave el ámbito de su IP, que debe pertenecer a alguno. Devuelve -1
+// si hay reservas inválidas o repetidas
+int reservation_compile(pool_config *cfg) {
+    reservation_table *table = &cfg->reservations;
+    size_t n = table->count;
+
+    if (n == 0) {
+        return 0;
+    }
+    if (cfg->num_scopes > 0xffff) {
+        fprintf(stderr, "Demasiados ámbitos para compilar las reservas\n");
+        return -1;
+    }
+    uint64_t *sorted = malloc(n * sizeof(uint64_t));
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    uint32_t *ips = malloc(n * sizeof(uint32_t));
+    if (sorted == NULL || keys == NULL || ips == NULL) {
+        perror("Error al asignar memoria para compilar las reservas");
+        exit(EXIT_FAILURE);
+    }
+
+    // Una MAC o una IP reservadas dos veces no tendrían una respuesta única
+    int valid = 1;
+    for (int pass = 0; pass < 2 && valid; pass++) {
+        for (size_t k = 0; k < n; k++) {
+            sorted[k] = pass == 0 ? table->keys[k] : table->ips[k];
+        }
+        qsort(sorted, n, sizeof(uint64_t), compare_u64);
+        for (size_t k = 1; k < n && valid; k++) {
+            if (sorted[k] == sorted[k - 1]) {
+                if (pass == 0) {
+                    char mac[18];
+                    dhcp_format_mac(sorted[k], mac);
+                    fprintf(stderr, "La MAC %s tiene más de una reserva\n", mac);
+                } else {
+                    fprintf(stderr, "La IP %u.%u.%u.%u está reservada para más de una MAC\n", (uint32_t)sorted[k] >> 24,
+                            ((uint32_t)sorted[k] >> 16) & 255, ((uint32_t)sorted[k] >> 8) & 255, (uint32_t)sorted[k] & 255);
+                }
+                valid = 0;
+            }
+        }
+    }
+    for (size_t k = 0; k < n && valid; k++) {
+        uint32_t ip = table->ips[k];
+        if (lpm_lookup(&cfg->trie, ip) < 0) {
+            fprintf(stderr, "La IP reservada %u.%u.%u.%u no pertenece a ningún ámbito\n", ip >> 24, (ip >> 16) & 255,
+                    (ip >> 8) & 255, ip & 255);
+            valid = 0;
+        }
+    }
+    free(sorted);
+    if (!valid) {
+        free(keys);
+        free(ips);
+        return -1;
+    }
+
+    table->nbuckets = (n + RESERVATION_GROUP - 1) / RESERVATION_GROUP;
+    table->seeds = malloc(table->nbuckets * sizeof(uint32_t));
+    if (table->seeds == NULL) {
+        perror("Error al asignar memoria para compilar las reservas");
+        exit(EXIT_FAILURE);
+    }
+    int placed = -1;
+    for (uint64_t attempt = 1; attempt <= 16 && placed < 0; attempt++) {
+        table->salt = mac_hash(attempt * 0x9e3779b97f4a7c15ULL);
+        placed = reservation_place(table, table->keys, table->ips, keys, ips);
+    }
+    if (placed < 0) {
+        fprintf(stderr, "No se pudo compilar la tabla de %zu reservas\n", n);
+        free(keys);
+        free(ips);
+        return -1;
+    }
+    for (size_t k = 0; k < n; k++) {
+        keys[k] |= (uint64_t)lpm_lookup(&cfg->trie, ips[k]) << 48;
+    }
+    free(table->keys);
+    free(table->ips);
+    table->keys = keys;
+    table->ips = ips;
+    table->capacity = n;
+
+    // Índice inverso: las posiciones en el orden de sus IPs
+    uint64_t *order = malloc(n * sizeof(uint64_t));
+    table->by_ip = malloc(n * sizeof(uint32_t));
+    if (order == NULL || table->by_ip == NULL) {
+        perror("Error al asignar memoria para compilar las reservas");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < n; k++) {
+        order[k] = (uint64_t)ips[k] << 32 | k;
+    }
+    qsort(order, n, sizeof(uint64_t), compare_u64);
+    for (size_t k = 0; k < n; k++) {
+        table->by_ip[k] = (uint32_t)order[k];
+    }
+    free(order);
+    return 0;
+}
+
+// Resultado de una consulta de lease (RFC 4388)
+typedef struct {
+    uint32_t ip;                 // Orden de host
+    uint64_t mac;
+    time_t expires;
+    time_t last_transaction;     // Último DHCPREQUEST: la expiración menos el lease del ámbito
+    uint32_t associated[LEASEQUERY_MAX_IPS];  // Todas las IPs con lease de la MAC
+    int num_associated;
+} lease_info;
+
+static inline int lease_active(const entry_snapshot *snap, time_t now) {
+    return snap->state == ENTRY_ASIGNADA && snap->mac != 0 && snap->mac != DECLINED_MAC && snap->expires > now;
+}
+
+static void lease_info_fill(pool_config *cfg, long i, const entry_snapshot *snap, lease_info *info) {
+    int s = lpm_lookup(&cfg->trie, cfg->ip_pool[i].ip_addr);
+    info->ip = cfg->ip_pool[i].ip_addr;
+    info->mac = snap->mac;
+    info->expires = snap->expires;
+    info->last_transaction = snap->expires - (s >= 0 ? cfg->scopes[s].lease_time : 0);
+}
+
+// Una reserva es un lease permanente del equipo: se responde con el lease completo de su
+// ámbito, el que recibe en cada renovación. El servidor no guarda su última transacción
+static void lease_info_reserved(pool_config *cfg, long k, time_t now, lease_info *info) {
+    const reservation_table *table = &cfg->reservations;
+    info->ip = table->ips[k];
+    info->mac = table->keys[k] & ((1ULL << 48) - 1);
+    info->expires = now + cfg->scopes[table->keys[k] >> 48].lease_time;
+    info->last_transaction = 0;
+}
+
+// Consulta por IP: DHCPLEASEACTIVE con su titular (o la MAC que la tiene reservada),
+// DHCPLEASEUNASSIGNED si la dirección es del pool pero no tiene lease o DHCPLEASEUNKNOWN
+// si no pertenece a ningún rango ni reserva. Solo lee una copia de la entrada: no toma
+// cerrojos ni escribe en el pool
+int lease_query_ip(pool_config *cfg, uint32_t ip, time_t now, lease_info *info) {
+    long k = reservation_find_ip(&cfg->reservations, ip);
+    if (k >= 0) {
+        lease_info_reserved(cfg, k, now, info);
+        info->num_associated = 0;
+        return DHCPLEASEACTIVE;
+    }
+    long i = pool_index(cfg, ip);
+    if (i < 0) {
+        return DHCPLEASEUNKNOWN;
+    }
+    entry_snapshot snap = entry_read(&cfg->ip_pool[i]);
+    if (!lease_active(&snap, now)) {
+        return DHCPLEASEUNASSIGNED;
+    }
+    lease_info_fill(cfg, i, &snap, info);
+    info->num_associated = 0;
+    return DHCPLEASEACTIVE;
+}
+
+// Consulta por MAC: el lease más reciente de la MAC y la lista de todos los suyos en los
+// distintos ámbitos, incluida su reserva; DHCPLEASEUNKNOWN si no tiene ninguno
+int lease_query_mac(pool_config *cfg, uint64_t mac, time_t now, lease_info *info) {
+    int slots[LEASEQUERY_MAX_IPS];
+
+    info->num_associated = 0;
+    long reserved = reservation_find(&cfg->reservations, mac);
+    if (reserved >= 0) {
+        lease_info_reserved(cfg, reserved, now, info);
+        info->associated[info->num_associated++] = info->ip;
+    }
+    int found = mac_index_find_all(&cfg->lease_index, mac, slots, LEASEQUERY_MAX_IPS - info->num_associated);
+    for (int k = 0; k < found; k++) {
+        entry_snapshot snap = entry_read(&cfg->ip_pool[slots[k]]);
+        if (snap.mac != mac || !lease_active(&snap, now)) {
+            continue;
+        }
+        lease_info candidate;
+        lease_info_fill(cfg, slots[k], &snap, &candidate);
+        if (info->num_associated == 0 || candidate.last_transaction > info->last_transaction) {
+            info->ip = candidate.ip;
+            info->mac = candidate.mac;
+            info->expires = candidate.expires;
+            info->last_transaction = candidate.last_transaction;
+        }
+        info->associated[info->num_associated++] = candidate.ip;
+    }
+    return info->num_associated > 0 ? DHCPLEASEACTIVE : DHCPLEASEUNKNOWN;
+}
+
+// Carga un fichero de reservas con líneas "MAC IP", el formato de leases.txt. Las
+// líneas vacías y las que empiezan por '#' se ignoran. Devuelve -1 si hay errores.
+int load_reservations(pool_config *cfg, const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int lineno = 0;
+
+    if (file == NULL) {
+        perror("Error al abrir el fichero de reservas");
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *save, *mac_str, *ip_str;
+        struct in_addr ip;
+
+        lineno++;
+        mac_str = strtok_r(line, " \t\r\n", &save);
+        if (mac_str == NULL || mac_str[0] == '#') {
+            continue;
+        }
+        ip_str = strtok_r(NULL, " \t\r\n", &save);
+        uint64_t mac = parse_mac(mac_str);
+        if (mac == 0 || ip_str == NULL || inet_pton(AF_INET, ip_str, &ip) != 1 || strtok_r(NULL, " \t\r\n", &save) != NULL) {
+            fprintf(stderr, "%s:%d: reserva inválida\n", path, lineno);
+            fclose(file);
+            return -1;
+        }
+        reservation_add(&cfg->reservations, mac, ntohl(ip.s_addr));
+    }
+    fclose(file);
+    return 0;
+}
+
+// Construye una configuración completa, sin publicarla, a partir del fichero (puede ser
+// NULL), del rango de la línea de órdenes (puede ser NULL) y del fichero de reservas
+// (puede ser NULL); devuelve NULL si es inválida
+pool_config *build_config(const char *path, const char *range_first, const char *range_last, const char *reserved) {
+    pool_config *cfg = calloc(1, sizeof(pool_config));
+    if (cfg == NULL) {
+        perror("Error al asignar memoria para la configuración");
+        exit(EXIT_FAILURE);
+    }
+    cfg->default_scope = -1;
+
+    if ((path != NULL && load_config(cfg, path) < 0) || (reserved != NULL && load_reservations(cfg, reserved) < 0)) {
+        free_config(cfg);
+        return NULL;
+    }
+    if (range_first != NULL) {
+        // Rango de la línea de órdenes: ámbito por defecto con las opciones fijas
+        struct in_addr start, end, mask;
+        if (inet_pton(AF_INET, range_first, &start) != 1 || inet_pton(AF_INET, range_last, &end) != 1 ||
+            inet_pton(AF_INET, SUBNET_MASK, &mask) != 1) {
+            fprintf(stderr, "Rango inválido: %s - %s\n", range_first, range_last);
+            free_config(cfg);
+            return NULL;
+        }
+        uint32_t first = ntohl(start.s_addr), last = ntohl(end.s_addr);
+        int prefix_len = __builtin_popcount(mask.s_addr);
+        // Un rango más ancho que la máscara se cubre con el prefijo común de sus extremos
+        int common = (first ^ last) ? __builtin_clz(first ^ last) : 32;
+        if (common < prefix_len) {
+            prefix_len = common;
+        }
+        cfg->default_scope = scope_add(cfg, first & prefix_mask(prefix_len), prefix_len, first, last, SUBNET_MASK,
+                                       DEFAULT_GATEWAY, DNS_SERVER, DOMAIN_NAME, LEASE_TIME, NTP_SERVERS,
+                                       CLASSLESS_ROUTES);
+        if (cfg->default_scope < 0) {
+            fprintf(stderr, "Rango inválido o ya definido en el fichero de configuración\n");
+            free_config(cfg);
+            return NULL;
+        }
+    }
+    if (init_ip_pool(cfg) < 0 || reservation_compile(cfg) < 0) {
+        free_config(cfg);
+        return NULL;
+    }
+    return cfg;
+}
+
+// Origen de la configuración, para reconstruirla al recargar
+const char *config_path;         // Fichero de configuración (-S) o NULL
+const char *config_range[2];     // Rango de la línea de órdenes o NULL
+const char *reservations_path;   // Fichero de reservas (-r) o NULL
+volatile sig_atomic_t reload_requested = 0;
+
+// Estado de una entrada de la configuración anterior al copiarla a la nueva
+typedef struct {
+    uint64_t mac;                // Titular (0 = libre)
+    time_t expires;
+    int adopted;                 // Se copió a la configuración nueva
+} lease_copy;
+
+static lease_copy entry_state(pool_config *cfg, long i) {
+    entry_snapshot snap = entry_read(&cfg->ip_pool[i]);
+    lease_copy state = { 0, 0, 0 };
+
+    if (snap.state == ENTRY_ASIGNADA) {
+        state.mac = snap.mac;
+        state.expires = snap.expires;
+    }
+    return state;
+}
+
+// Vincula en la configuración nueva un lease traído de la anterior; devuelve 0 si la
+// dirección no existe en ella, está excluida o ya la ocupa otro cliente
+static int adopt_lease(pool_config *cfg, uint32_t ip, const lease_copy *lease) {
+    long i = pool_index(cfg, ip);
+    if (i < 0) {
+        return 0;
+    }
+    pool_shard *shard = shard_of(cfg, i);
+    if (peer_owned(ip) ? atomic_load(&cfg->ip_pool[i].state) != ENTRY_LIBRE
+                       : !bitmap_claim(&shard->free_map, i - shard->first)) {
+        return 0;
+    }
+    entry_set(&cfg->ip_pool[i], lease->mac, ENTRY_ASIGNADA, lease->expires);
+    if (lease->mac != DECLINED_MAC) {
+        mac_index_insert(&cfg->lease_index, lease->mac, i);
+    }
+    wheel_schedule(&shard->timers, i, lease->expires);
+    return 1;
+}
+
+// Recarga la configuración (SIGHUP) sin detener el servicio. La nueva se construye
+// aparte y recibe una copia de los leases vigentes; después se publica y, cuando ningún
+// hilo puede seguir leyendo la anterior, se le traen los cambios que esta recibió
+// mientras tanto y se libera. Los trabajadores no esperan en ningún momento.
+void reload_config(void) {
+    pool_config *old = atomic_load(&active_config);
+    uint64_t start_ns = monotonic_ns();
+    long adopted = 0, live = 0, dropped = 0;
+
+    if (config_path == NULL && reservations_path == NULL) {
+        LOG(LOG_WARN, "Recarga ignorada: el servidor no usa fichero de configuración (-S) ni de reservas (-r)");
+        return;
+    }
+    pool_config *cfg = build_config(config_path, config_range[0], config_range[1], reservations_path);
+    if (cfg == NULL) {
+        LOG(LOG_ERROR, "Recarga cancelada: se mantiene la configuración anterior");
+        return;
+    }
+    cfg->generation = old->generation + 1;
+
+    lease_copy *copied = malloc(old->pool_size * sizeof(lease_copy));
+    if (copied == NULL) {
+        perror("Error al asignar memoria para la recarga");
+        exit(EXIT_FAILURE);
+    }
+
+    // Primera pasada: la configuración nueva aún es privada
+    for (long i = 0; i < old->pool_size; i++) {
+        copied[i] = entry_state(old, i);
+        if (copied[i].mac != 0) {
+            copied[i].adopted = adopt_lease(cfg, old->ip_pool[i].ip_addr, &copied[i]);
+            adopted += copied[i].adopted;
+        }
+    }
+
+    atomic_store(&active_config, cfg);
+    epoch_synchronize();
+
+    // Segunda pasada: la anterior ya no cambia. Lo que se modificó en ella durante la
+    // publicación se aplica a la nueva salvo que la entrada nueva ya haya cambiado
+    // por su cuenta, en cuyo caso prevalece la nueva.
+    for (long i = 0; i < old->pool_size; i++) {
+        lease_copy state = entry_state(old, i);
+        uint32_t ip = old->ip_pool[i].ip_addr;
+        long j = pool_index(cfg, ip);
+
+        if (state.mac != 0) {
+            live++;
+        }
+        int changed = state.mac != copied[i].mac || (state.mac != 0 && state.expires != copied[i].expires);
+        if (j >= 0 && changed) {
+            lease_copy current = entry_state(cfg, j);
+            uint64_t expected = copied[i].adopted ? copied[i].mac : 0;
+            if (current.mac == expected && (expected == 0 || current.expires == copied[i].expires)) {
+                if (current.mac != 0 && current.mac == state.mac) {
+                    wheel_renew(&shard_of(cfg, j)->timers, j, ENTRY_ASIGNADA, state.expires);
+                } else {
+                    if (current.mac != 0) {
+                        wheel_cancel(&shard_of(cfg, j)->timers, j);
+                        release_entry(cfg, j);
+                    }
+                    if (state.mac != 0) {
+                        adopted += adopt_lease(cfg, ip, &state);
+                    }
+                }
+                journal_note(ip);
+            }
+        }
+        if (state.mac != 0 && (j < 0 || entry_state(cfg, j).mac != state.mac)) {
+            dropped++;
+        }
+    }
+
+    // El total de leases pasa a contar los de la configuración nueva. Las ofertas
+    // pendientes no se migran: su DHCPREQUEST reclama la IP en la nueva si sigue libre
+    long offers = 0;
+    for (long i = 0; i < old->pool_size; i++) {
+        offers += atomic_load(&old->ip_pool[i].state) == ENTRY_OFRECIDA;
+    }
+    metric_leased(adopted - live);
+    metric_offered(-offers);
+    free(copied);
+    free_config(old);
+
+    LOG(LOG_INFO, "Configuración recargada (generación %lu): %d ámbitos, %d IPs; %ld leases migrados y %ld descartados en %.1f ms",
+        cfg->generation, cfg->num_scopes, cfg->pool_size, live - dropped, dropped, (monotonic_ns() - start_ns) / 1e6);
+}
+
+// Construye las opciones del mensaje DHCP (oferta y ACK) a partir de la plantilla;
+// devuelve la longitud total del mensaje
+size_t build_dhcp_options(dhcp_packet *response, const option_template *tpl, int message_type, int lease_time) {
+    uint32_t lease = htonl(lease_time);
+
+    memcpy(response->options, tpl->bytes, tpl->length);
+    response->options[tpl->type_offset] = message_type;
+    memcpy(&response->options[tpl->lease_offset], &lease, 4);
+    return dhcp_finish(response, tpl->length - 1);
+}
+
+// Copia en la respuesta los campos de la solicitud que el cliente necesita para reconocerla
+static void init_reply(dhcp_packet *response, const dhcp_packet *request) {
+    memset(response, 0, DHCP_OPTIONS_START);
+    response->op = BOOTREPLY;
+    response->htype = request->htype;
+    response->hlen = request->hlen;
+    response->xid = request->xid;
+    response->flags = request->flags;
+    response->giaddr = request->giaddr;
+    memcpy(response->chaddr, request->chaddr, sizeof(response->chaddr));
+    response->cookie = htonl(DHCP_MAGIC_COOKIE);
+}
+
+// Destino de la respuesta (RFC 2131, 4.1): al relay si hay giaddr; a un cliente real en
+// el puerto 68 por unicast a ciaddr o por difusión; en otro caso, al origen (pruebas)
+static void reply_destination(const dhcp_packet *request, const struct sockaddr_in *source, struct sockaddr_in *dest) {
+    *dest = *source;
+    if (request->giaddr != 0 || ntohs(source->sin_port) != DHCP_CLIENT_PORT) {
+        return;
+    }
+    dest->sin_addr.s_addr = request->ciaddr != 0 ? request->ciaddr : htonl(INADDR_BROADCAST);
+}
+
+// Envía un DHCPOFFER o DHCPACK para la IP indicada (orden de host) con las opciones de su ámbito
+static void send_lease_reply(int sockfd, const dhcp_packet *request, const dhcp_scope *scope, int type, uint32_t ip,
+                             const struct sockaddr_in *dest) {
+    dhcp_packet response;
+
+    init_reply(&response, request);
+    response.yiaddr = htonl(ip);
+    size_t len = build_dhcp_options(&response, &scope->options, type, scope->lease_time);
+    send_reply(sockfd, &response, len, dest);
+    metric_add(&metrics()->tx_type[type], 1);
+}
+
+static void send_nak(int sockfd, const dhcp_packet *request, const struct sockaddr_in *dest) {
+    dhcp_packet response;
+    uint8_t type = DHCPNAK;
+    size_t pos = 0;
+
+    init_reply(&response, request);
+    dhcp_put_option(&response, &pos, OPT_MESSAGE_TYPE, 1, &type);
+    dhcp_put_option(&response, &pos, OPT_SERVER_ID, 4, &server_id);
+    send_reply(sockfd, &response, dhcp_finish(&response, pos), dest);
+    metric_add(&metrics()->tx_type[DHCPNAK], 1);
+}
+
+// Responde a un DHCPLEASEQUERY (RFC 4388) por IP (ciaddr) o por MAC (chaddr). Las
+// entradas se leen con copias sin cerrojos, de modo que una avalancha de consultas no
+// retrasa la asignación. Las consultas por identificador de cliente reciben
+// DHCPLEASEUNKNOWN: el servidor no los guarda. La respuesta vuelve al origen, que es el
+// router (giaddr) o la herramienta que consulta
+static void answer_leasequery(pool_config *cfg, const client_data *data, const dhcp_view *view) {
+    const dhcp_packet *msg = &data->msg;
+    uint64_t mac = dhcp_client_mac(msg);
+    time_t now = time(NULL);
+    dhcp_packet response;
+    lease_info info;
+    size_t pos = 0;
+    int type;
+
+    if (msg->ciaddr != 0) {
+        type = lease_query_ip(cfg, ntohl(msg->ciaddr), now, &info);
+    } else if (mac != 0) {
+        type = lease_query_mac(cfg, mac, now, &info);
+    } else if (dhcp_option(view, OPT_CLIENT_ID, NULL) != NULL) {
+        type = DHCPLEASEUNKNOWN;
+    } else {
+        LOG(LOG_WARN, "DHCPLEASEQUERY sin IP, MAC ni identificador de cliente descartado");
+        metric_add(&metrics()->malformed, 1);
+        return;
+    }
+
+    init_reply(&response, msg);
+    response.ciaddr = msg->ciaddr;
+    uint8_t code = type;
+    dhcp_put_option(&response, &pos, OPT_MESSAGE_TYPE, 1, &code);
+    dhcp_put_option(&response, &pos, OPT_SERVER_ID, 4, &server_id);
+    if (type == DHCPLEASEACTIVE) {
+        uint32_t remaining = htonl(info.expires - now);
+        uint32_t elapsed = htonl(now > info.last_transaction ? now - info.last_transaction : 0);
+        response.ciaddr = htonl(info.ip);
+        dhcp_set_client_mac(&response, info.mac);
+        dhcp_put_option(&response, &pos, OPT_LEASE_TIME, 4, &remaining);
+        if (info.last_transaction != 0) {
+            dhcp_put_option(&response, &pos, OPT_CLIENT_LAST_TRANSACTION, 4, &elapsed);
+        }
+        if (info.num_associated > 1) {
+            uint32_t ips[LEASEQUERY_MAX_IPS];
+            for (int k = 0; k < info.num_associated; k++) {
+                ips[k] = htonl(info.associated[k]);
+            }
+            dhcp_put_option(&response, &pos, OPT_ASSOCIATED_IP, 4 * info.num_associated, ips);
+        }
+        LOG(LOG_DEBUG, "DHCPLEASEQUERY: IP %I asignada a %M", info.ip, info.mac);
+    } else {
+        LOG(LOG_DEBUG, "DHCPLEASEQUERY de %I respondido con %s", ntohl(data->client_addr.sin_addr.s_addr),
+            dhcp_type_name(type));
+    }
+    send_reply(data->sockfd, &response, dhcp_finish(&response, pos), &data->client_addr);
+    metric_add(&metrics()->tx_type[type], 1);
+}
+
+// Procesa una solicitud de cliente (invocado desde un hilo trabajador dentro de una
+// sección de época sobre cfg)
+void handle_client(pool_config *cfg, client_data *data) {
+    const dhcp_packet *msg = &data->msg;
+    int sockfd = data->sockfd;
+    struct sockaddr_in reply_addr;
+    dhcp_view view;
+    uint32_t ip, option;
+    thread_metrics *m = metrics();
+
+    request_rx_ns = data->rx_ns;
+    if (dhcp_parse(msg, data->len, &view) < 0 || msg->op != BOOTREQUEST) {
+        LOG(LOG_WARN, "Mensaje DHCP mal formado descartado");
+        metric_add(&m->malformed, 1);
+        return;
+    }
+    int type = dhcp_message_type(&view);
+    metric_add(&m->rx_type[type < METRIC_TYPES ? type : 0], 1);
+
+    // Las consultas de leases no vienen del cliente: no necesitan su MAC ni un ámbito
+    if (type == DHCPLEASEQUERY) {
+        answer_leasequery(cfg, data, &view);
+        return;
+    }
+    uint64_t mac = dhcp_client_mac(msg);
+    if (mac == 0) {
+        LOG(LOG_WARN, "Mensaje con MAC inválida descartado");
+        metric_add(&m->malformed, 1);
+        return;
+    }
+    reply_destination(msg, &data->client_addr, &reply_addr);
+
+    // RELEASE y DECLINE identifican la IP por sí mismos; el resto necesita un ámbito
+    dhcp_scope *scope = select_scope(cfg, msg);
+    if (scope == NULL && type != DHCPRELEASE && type != DHCPDECLINE) {
+        LOG(LOG_WARN, "Sin ámbito para %M (giaddr %I), mensaje descartado", mac, ntohl(msg->giaddr));
+        metric_add(&m->no_scope, 1);
+        return;
+    }
+
+    switch (type) {
+        case DHCPDISCOVER:
+            LOG(LOG_DEBUG, "Recibido DHCPDISCOVER de %M", mac);
+            if (!ha_serves(cfg, scope, mac, msg->giaddr)) {
+                LOG(LOG_DEBUG, "DHCPDISCOVER de %M atendido por el otro servidor del par", mac);
+                metric_add(&m->deferred, 1);
+                break;
+            }
+            if (reservation_lookup(&cfg->reservations, mac, scope - cfg->scopes, &ip)) {
+                LOG(LOG_INFO, "IP reservada %I ofrecida a %M", ip, mac);
+                send_lease_reply(sockfd, msg, scope, DHCPOFFER, ip, &reply_addr);
+            } else if (assign_ip_dynamic(cfg, scope, mac, &ip) == 0) {
+                LOG(LOG_INFO, "IP %I ofrecida a %M", ip, mac);
+                send_lease_reply(sockfd, msg, scope, DHCPOFFER, ip, &reply_addr);
+                LOG(LOG_DEBUG, "Enviado DHCPOFFER de %I a %M", ip, mac);
+            } else {
+                LOG(LOG_WARN, "No hay IPs disponibles para asignar");
+                metric_add(&m->pool_exhausted, 1);
+            }
+            break;
+
+        case DHCPREQUEST: // Selección de una oferta, renovación o reinicio
+            // El cliente eligió la oferta de otro servidor: se libera la nuestra. En un par HA
+            // el otro servidor comparte los leases y solo se liberan las ofertas
+            if (dhcp_option_u32(&view, OPT_SERVER_ID, &option) && option != server_id) {
+                long i = mac_index_lookup(&cfg->lease_index, mac, scope->first, scope->first + scope->count);
+                LOG(LOG_INFO, "DHCPREQUEST de %M dirigido a otro servidor", mac);
+                if (i >= 0 && (!ha.enabled || atomic_load(&cfg->ip_pool[i].state) == ENTRY_OFRECIDA)) {
+                    release_ip_dynamic(cfg, mac, cfg->ip_pool[i].ip_addr);
+                }
+                break;
+            }
+            ip = dhcp_option_u32(&view, OPT_REQUESTED_IP, &option) ? ntohl(option) : ntohl(msg->ciaddr);
+            LOG(LOG_DEBUG, "Recibido DHCPREQUEST de %M para la IP %I", mac, ip);
+            // Un cliente con reserva solo puede usar su IP reservada
+            uint32_t reserved;
+            int granted = reservation_lookup(&cfg->reservations, mac, scope - cfg->scopes, &reserved) ? ip == reserved
+                                                                                                   : request_ip(cfg, scope, mac, ip);
+            if (granted < 0) {
+                LOG(LOG_DEBUG, "DHCPREQUEST de %M para la IP %I atendido por el otro servidor del par", mac, ip);
+                break;
+            }
+            if (!granted) {
+                send_nak(sockfd, msg, &reply_addr);
+                LOG(LOG_INFO, "Enviado DHCPNAK para la IP %I a %M", ip, mac);
+                break;
+            }
+            LOG(LOG_INFO, "Renovando IP %I para %M", ip, mac);
+            send_lease_reply(sockfd, msg, scope, DHCPACK, ip, &reply_addr);
+            LOG(LOG_DEBUG, "Enviado DHCPACK para la IP %I a %M", ip, mac);
+            break;
+
+        case DHCPDECLINE:
+            if (dhcp_option_u32(&view, OPT_REQUESTED_IP, &option)) {
+                LOG(LOG_WARN, "Recibido DHCPDECLINE de %M para la IP %I", mac, ntohl(option));
+                decline_ip(cfg, mac, ntohl(option));
+            }
+            break;
 
-ip_entry *ip_pool;
-int pool_size = 0;
-int active_threads = 0;          // Contador de hilos activos
-pthread_mutex_t lock;            // Mutex para controlar el acceso a los recursos compartidos
+        case DHCPRELEASE:
+            LOG(LOG_DEBUG, "Recibido DHCPRELEASE de %M para la IP %I", mac, ntohl(msg->ciaddr));
+            release_ip_dynamic(cfg, mac, ntohl(msg->ciaddr));
+            break;
 
-unsigned int ip_to_int(const char *ip_str) {
-    struct sockaddr_in sa;
-    inet_pton(AF_INET, ip_str, &(sa.sin_addr));
-    return ntohl(sa.sin_addr.s_addr);
+        default:
+            LOG(LOG_WARN, "Mensaje desconocido recibido de %M", mac);
+            break;
+    }
 }
 
-void int_to_ip(unsigned int ip, char *ip_str) {
-    struct in_addr addr;
-    addr.s_addr = htonl(ip);
-    inet_ntop(AF_INET, &addr, ip_str, INET_ADDRSTRLEN);
+// Hilo trabajador persistente: toma mensajes de la cola y los devuelve a la lista libre
+void* worker_thread(void* arg) {
+    (void)arg;
+    unsigned int slot;
+
+    if (io_mode == IO_BATCH) {
+        tx_batch = reply_batch_create();
+    }
+
+    while (1) {
+        // Sin más trabajo inmediato se vacía el lote de respuestas antes de dormir
+        if (tx_batch != NULL && tx_batch->count > 0 && sem_trywait(&work_sem) == 0) {
+            // Había trabajo pendiente: se sigue acumulando
+        } else {
+            if (tx_batch != NULL && tx_batch->count > 0) {
+                flush_replies(tx_batch);
+            }
+            while (sem_wait(&work_sem) != 0 && errno == EINTR)
+                ;
+        }
+        // El semáforo garantiza que hay un elemento; solo se reintenta si el productor aún no lo
+        // publicó. La clase alta se vacía primero
+        while (ring_pop(&work_ring[PRIO_ALTA], &slot) != 0 && ring_pop(&work_ring[PRIO_BAJA], &slot) != 0)
+            ;
+        handle_client(config_enter(), &msg_slots[slot]);
+        config_exit();
+        ring_push(&free_ring, slot);
+    }
+    return NULL;
 }
 
-// Inicializa el pool de direcciones IP
-void init_ip_pool(const char *ip_start, const char *ip_end) {
-    unsigned int start = ip_to_int(ip_start);
-    unsigned int end = ip_to_int(ip_end);
-    pool_size = end - start + 1;
+// Arranca los trabajadores y prepara los mensajes preasignados
+void init_workers(int num_workers, size_t queue_size) {
+    size_t capacity = 1;
+    while (capacity < queue_size) {
+        capacity <<= 1;
+    }
 
-    ip_pool = (ip_entry *)malloc(pool_size * sizeof(ip_entry));
-    if (ip_pool == NULL) {
-        perror("Error al asignar memoria para el pool de IPs");
+    // Un mensaje más que la cola: la reserva del receptor
+    msg_slots = calloc(capacity + 1, sizeof(client_data));
+    if (msg_slots == NULL) {
+        perror("Error al asignar memoria para los mensajes");
+        exit(EXIT_FAILURE);
+    }
+    ring_init(&free_ring, capacity);
+    for (int c = 0; c < PRIO_CLASES; c++) {
+        ring_init(&work_ring[c], capacity);
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        ring_push(&free_ring, i);
+    }
+    spare_slot = capacity;
+
+    if (sem_init(&work_sem, 0, 0) != 0) {
+        perror("Error al inicializar el semáforo");
         exit(EXIT_FAILURE);
     }
 
-    for (int i = 0; i < pool_size; i++) {
-        ip_pool[i].ip_addr = start + i;
-        ip_pool[i].is_assigned = 0;
+    for (int i = 0; i < num_workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
+            perror("Error al crear el hilo");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
     }
+    LOG(LOG_INFO, "%d hilos trabajadores iniciados (cola de %zu mensajes)", num_workers, capacity);
 }
 
-// Asigna una IP dinámica del pool
-int assign_ip_dynamic(char *assigned_ip) {
-    time_t current_time = time(NULL);
+// Límite por MAC con cubetas de fichas. La tabla es de acceso directo por hash de la
+// MAC y cada cubeta es una palabra (última recarga en ms y fichas en 1/256) que se
+// actualiza con compare-and-swap, así que la comparten todos los receptores sin
+// cerrojos. Dos MACs que caen en la misma cubeta comparten su límite.
+_Atomic uint64_t *rate_table;
+uint32_t rate_per_sec = DEFAULT_RATE;
+uint32_t rate_burst = DEFAULT_BURST;
 
-    for (int i = 0; i < pool_size; i++) {
-        if (!ip_pool[i].is_assigned) {
-            ip_pool[i].is_assigned = 1;
-            ip_pool[i].lease_expiration = current_time + LEASE_TIME;
-            int_to_ip(ip_pool[i].ip_addr, assigned_ip);
-            return 0;
+void rate_init(void) {
+    if (rate_per_sec == 0 || rate_table != NULL) {
+        return;
+    }
+    rate_table = calloc((size_t)1 << RATE_TABLE_BITS, sizeof(*rate_table));
+    if (rate_table == NULL) {
+        perror("Error al asignar memoria para los límites por MAC");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Tipo de un mensaje sin decodificarlo entero: solo se busca la opción 53 en la zona
+// principal de opciones (0 si no la tiene)
+static int peek_message_type(const client_data *data) {
+    const uint8_t *opt = data->msg.options;
+    size_t end = data->len > DHCP_OPTIONS_START ? data->len - DHCP_OPTIONS_START : 0;
+    size_t pos = 0;
+
+    while (pos + 2 < end && opt[pos] != OPT_END) {
+        if (opt[pos] == OPT_PAD) {
+            pos++;
+            continue;
+        }
+        if (opt[pos] == OPT_MESSAGE_TYPE) {
+            return opt[pos + 2];
         }
+        pos += 2 + opt[pos + 1];
     }
-    return -1;
+    return 0;
 }
 
-// Libera una IP en función del mensaje DHCPRELEASE
-void release_ip_dynamic(const char *ip_str) {
-    unsigned int ip = ip_to_int(ip_str);
-    for (int i = 0; i < pool_size; i++) {
-        if (ip_pool[i].ip_addr == ip) {
-            ip_pool[i].is_assigned = 0;
-            printf("IP %s liberada\n", ip_str);
-            break;
+// Consume una ficha de la cubeta del remitente; devuelve 0 si ha superado su límite.
+// DHCPLEASEQUERY no se limita: su chaddr es el cliente consultado, no quien pregunta
+static int rate_allow(const client_data *data) {
+    if (rate_table == NULL || data->len < DHCP_OPTIONS_START) {
+        return 1;  // Sin límite, o mensaje que handle_client descartará
+    }
+    if (peek_message_type(data) == DHCPLEASEQUERY) {
+        return 1;
+    }
+    uint64_t mac = dhcp_client_mac(&data->msg);
+    _Atomic uint64_t *cell = &rate_table[mac_hash(mac) >> (64 - RATE_TABLE_BITS)];
+    uint64_t now_ms = data->rx_ns / 1000000;
+    uint64_t capacity = (uint64_t)rate_burst * RATE_SCALE;
+    uint64_t old = atomic_load_explicit(cell, memory_order_relaxed);
+
+    while (1) {
+        uint64_t tokens = capacity;  // Cubeta sin usar: llena
+        if (old != 0) {
+            uint64_t last = old >> 24;
+            tokens = old & 0xffffff;
+            if (now_ms > last) {
+                tokens += (now_ms - last) * rate_per_sec * RATE_SCALE / 1000;
+                if (tokens > capacity) {
+                    tokens = capacity;
+                }
+            }
+        }
+        if (tokens < RATE_SCALE) {
+            thread_metrics *m = metrics();
+            metric_add(&m->rate_limited, 1);
+            uint64_t limited = atomic_load_explicit(&m->rate_limited, memory_order_relaxed);
+            if ((limited & (limited - 1)) == 0) {
+                LOG(LOG_WARN, "Límite de %u mensajes/s superado por %M (%lu descartados)", rate_per_sec, mac, limited);
+            }
+            return 0;
+        }
+        uint64_t updated = (now_ms << 24) | (tokens - RATE_SCALE);
+        if (atomic_compare_exchange_weak_explicit(cell, &old, updated, memory_order_relaxed, memory_order_relaxed)) {
+            return 1;
         }
     }
 }
 
-// Verifica si las concesiones de IP han expirado
-void check_ip_leases() {
-    time_t current_time = time(NULL);  // Obtener el tiempo actual
-    char ip_str[INET_ADDRSTRLEN];
-
-    for (int i = 0; i < pool_size; i++) {
-        if (ip_pool[i].is_assigned && ip_pool[i].lease_expiration <= current_time) {
-            int_to_ip(ip_pool[i].ip_addr, ip_str);
-            printf("El tiempo de concesión de la IP %s ha expirado, liberando...\n", ip_str);
-            ip_pool[i].is_assigned = 0;
-        }
-    }
-}
-
-// Construye las opciones del mensaje DHCP (oferta y ACK)
-void build_dhcp_options(dhcp_message *response, const char* subnet_mask, const char* gateway, const char* dns, const char* domain, int lease_time) {
-    uint8_t *options = response->options;
-    int offset = 0;
-
-    options[offset++] = 53; // Código para el tipo de mensaje DHCP
-    options[offset++] = 1;
-    options[offset++] = response->message_type;
-
-    // Máscara de subred
-    options[offset++] = 1;
-    options[offset++] = 4;
-    inet_pton(AF_INET, subnet_mask, &options[offset]);
-    offset += 4;
-
-    // Puerta de enlace
-    options[offset++] = 3;
-    options[offset++] = 4;
-    inet_pton(AF_INET, gateway, &options[offset]);
-    offset += 4;
-
-    // Servidor DNS
-    options[offset++] = 6;
-    options[offset++] = 4;
-    inet_pton(AF_INET, dns, &options[offset]);
-    offset += 4;
-
-    // Nombre de dominio
-    size_t domain_len = strlen(domain);
-    options[offset++] = 15;
-    options[offset++] = domain_len;
-    memcpy(&options[offset], domain, domain_len);
-    offset += domain_len;
-
-    // Tiempo de concesión
-    options[offset++] = 51;
-    options[offset++] = 4;
-    lease_time = htonl(lease_time);
-    memcpy(&options[offset], &lease_time, 4);
-    offset += 4;
-
-    // Fin de las opciones
-    options[offset++] = 255;
-}
-
-// Maneja las solicitudes de clientes en hilos separados
-void* handle_client(void* arg) {
-    client_data *data = (client_data*) arg;
-    dhcp_message *msg = data->msg;
-    int sockfd = data->sockfd;
-    struct sockaddr_in client_addr = data->client_addr;
-
-    dhcp_message response;
-    char assigned_ip[16];
-
-    switch (msg->message_type) {
-        case 1: // DHCPDISCOVER
-            printf("Recibido DHCPDISCOVER de %s\n", msg->client_mac);
-            if (assign_ip_dynamic(assigned_ip) == 0) {
-                printf("IP %s asignada a %s\n", assigned_ip, msg->client_mac);
-                response.message_type = 2; // DHCPOFFER
-                strcpy(response.client_mac, msg->client_mac);
-                strcpy(response.requested_ip, assigned_ip);
-                build_dhcp_options(&response, SUBNET_MASK, DEFAULT_GATEWAY, DNS_SERVER, DOMAIN_NAME, LEASE_TIME);
-                sendto(sockfd, &response, sizeof(response), 0, (struct sockaddr*)&client_addr, sizeof(client_addr));
-                printf("Enviado DHCPOFFER de %s a %s\n", assigned_ip, msg->client_mac);
-            } else {
-                printf("No hay IPs disponibles para asignar\n");
+// Clase de un mensaje: las renovaciones y liberaciones van a la alta; DHCPDISCOVER,
+// DHCPINFORM, DHCPLEASEQUERY y los mensajes sin tipo, a la baja
+static int message_class(const client_data *data) {
+    int type = peek_message_type(data);
+    return (type == DHCPREQUEST || type == DHCPRELEASE || type == DHCPDECLINE) ? PRIO_ALTA : PRIO_BAJA;
+}
+
+// Anota un descarte por cola llena, con un aviso en cada potencia de dos
+static void count_shed(int class) {
+    thread_metrics *m = metrics();
+    metric_add(&m->dropped, 1);
+    metric_add(&m->shed[class], 1);
+    unsigned long dropped = atomic_load_explicit(&m->dropped, memory_order_relaxed);
+    if ((dropped & (dropped - 1)) == 0) {
+        LOG(LOG_WARN, "Cola llena, %lu paquetes descartados (%lu de prioridad alta)", dropped,
+            (unsigned long)atomic_load_explicit(&m->shed[PRIO_ALTA], memory_order_relaxed));
+    }
+}
+
+// Aplica el límite por MAC y encola el mensaje en su clase; devuelve -1 si se
+// descarta (el llamante recupera el mensaje)
+static int enqueue_message(unsigned int slot) {
+    client_data *data = &msg_slots[slot];
+    if (!rate_allow(data)) {
+        return -1;
+    }
+    // Las colas de trabajo tienen la misma capacidad que los mensajes, nunca se llenan
+    ring_push(&work_ring[message_class(data)], slot);
+    sem_post(&work_sem);
+    return 0;
+}
+
+// Sin mensajes libres el datagrama se lee en la reserva del receptor para clasificarlo:
+// uno de prioridad alta ocupa el lugar del DHCPDISCOVER más antiguo de la cola; el
+// resto se descarta. El receptor nunca se bloquea
+static void receive_overflow(int sockfd) {
+    client_data *data = &msg_slots[spare_slot];
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    thread_metrics *m = metrics();
+    unsigned int victim;
+
+    metric_add(&m->rx_calls, 1);
+    ssize_t len = recvfrom(sockfd, &data->msg, sizeof(dhcp_packet), MSG_DONTWAIT,
+                           (struct sockaddr*)&data->client_addr, &addr_len);
+    if (len < 0) {
+        return;
+    }
+    metric_add(&m->rx_packets, 1);
+    data->len = len;
+    data->rx_ns = monotonic_ns();
+    data->sockfd = sockfd;
+    if (!rate_allow(data)) {
+        return;
+    }
+
+    int class = message_class(data);
+    if (class == PRIO_ALTA && ring_pop(&work_ring[PRIO_BAJA], &victim) == 0) {
+        // El desalojado ya contaba en el semáforo: el nuevo ocupa su lugar sin sem_post
+        ring_push(&work_ring[PRIO_ALTA], spare_slot);
+        spare_slot = victim;
+        metric_add(&m->evicted, 1);
+        class = PRIO_BAJA;
+    }
+    count_shed(class);
+}
+
+// Recibe un datagrama con recvfrom y lo encola (modo clásico)
+void receive_one(int sockfd) {
+    unsigned int slot;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+
+    if (ring_pop(&free_ring, &slot) != 0) {
+        receive_overflow(sockfd);
+        return;
+    }
+
+    client_data *data = &msg_slots[slot];
+    thread_metrics *m = metrics();
+    metric_add(&m->rx_calls, 1);
+    ssize_t len = recvfrom(sockfd, &data->msg, sizeof(dhcp_packet), 0, (struct sockaddr*)&data->client_addr, &addr_len);
+    if (len < 0) {
+        perror("Error al recibir mensaje");
+        ring_push(&free_ring, slot);
+        return;
+    }
+    data->len = len;
+    data->rx_ns = monotonic_ns();
+    metric_add(&m->rx_packets, 1);
+
+    data->sockfd = sockfd;
+    if (enqueue_message(slot) != 0) {
+        ring_push(&free_ring, slot);
+    }
+}
+
+// Recibe hasta batch_size datagramas por llamada con recvmmsg directamente en
+// los mensajes preasignados; repite mientras el lote llegue completo
+void receive_batch(int sockfd) {
+    unsigned int slots[MAX_BATCH];
+    struct mmsghdr hdrs[MAX_BATCH];
+    struct iovec iov[MAX_BATCH];
+    int got;
+
+    do {
+        int n = 0;
+        while (n < batch_size && ring_pop(&free_ring, &slots[n]) == 0) {
+            client_data *data = &msg_slots[slots[n]];
+            iov[n].iov_base = &data->msg;
+            iov[n].iov_len = sizeof(dhcp_packet);
+            memset(&hdrs[n], 0, sizeof(hdrs[n]));
+            hdrs[n].msg_hdr.msg_name = &data->client_addr;
+            hdrs[n].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            hdrs[n].msg_hdr.msg_iov = &iov[n];
+            hdrs[n].msg_hdr.msg_iovlen = 1;
+            n++;
+        }
+        if (n == 0) {
+            receive_overflow(sockfd);
+            return;
+        }
+
+        got = recvmmsg(sockfd, hdrs, n, MSG_DONTWAIT, NULL);
+        uint64_t rx_ns = monotonic_ns();
+        thread_metrics *m = metrics();
+        metric_add(&m->rx_calls, 1);
+        if (got < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error en recvmmsg");
             }
-            break;
+            got = 0;
+        }
+        metric_add(&m->rx_packets, got);
 
-        case 3: // DHCPREQUEST (para asignación inicial o renovación)
-            printf("Recibido DHCPREQUEST de %s para la IP %s\n", msg->client_mac, msg->requested_ip);
-            for (int i = 0; i < pool_size; i++) {
-                if (ip_pool[i].is_assigned && strcmp(msg->requested_ip, inet_ntoa((struct in_addr){htonl(ip_pool[i].ip_addr)})) == 0) {
-                    ip_pool[i].lease_expiration = time(NULL) + LEASE_TIME;
-                    printf("Renovando IP %s para %s\n", msg->requested_ip, msg->client_mac);
-                    break;
-                }
+        for (int i = 0; i < got; i++) {
+            msg_slots[slots[i]].sockfd = sockfd;
+            msg_slots[slots[i]].rx_ns = rx_ns;
+            msg_slots[slots[i]].len = hdrs[i].msg_len;
+            if (enqueue_message(slots[i]) != 0) {
+                ring_push(&free_ring, slots[i]);
             }
-            response.message_type = 4; // DHCPACK
-            strcpy(response.client_mac, msg->client_mac);
-            strcpy(response.requested_ip, msg->requested_ip);
-            build_dhcp_options(&response, SUBNET_MASK, DEFAULT_GATEWAY, DNS_SERVER, DOMAIN_NAME, LEASE_TIME);
-            sendto(sockfd, &response, sizeof(response), 0, (struct sockaddr*)&client_addr, sizeof(client_addr));
-            printf("Enviado DHCPACK para la IP %s a %s\n", msg->requested_ip, msg->client_mac);
-            break;
+        }
+        for (int i = got; i < n; i++) {
+            ring_push(&free_ring, slots[i]);
+        }
+        if (got < n) {
+            return;
+        }
+    } while (running);
+}
 
-        case 5: // DHCPRELEASE
-            printf("Recibido DHCPRELEASE de %s para la IP %s\n", msg->client_mac, msg->requested_ip);
-            release_ip_dynamic(msg->requested_ip);
-            break;
+void handle_signal(int signum) {
+    if (signum == SIGHUP) {
+        reload_requested = 1;
+        return;
+    }
+    running = 0;
+}
 
-        default:
-            printf("Mensaje desconocido recibido\n");
-            break;
+// Resumen de llamadas al sistema por paquete al terminar
+void print_io_stats(void) {
+    metrics_totals t;
+    metrics_collect(&t);
+    printf("E/S: %lu paquetes recibidos en %lu llamadas (%.3f llamadas/paquete), %lu enviados en %lu llamadas (%.3f llamadas/paquete), %lu descartados\n",
+           t.rx_packets, t.rx_calls, t.rx_packets ? (double)t.rx_calls / t.rx_packets : 0.0,
+           t.tx_packets, t.tx_calls, t.tx_packets ? (double)t.tx_calls / t.tx_packets : 0.0, t.dropped);
+}
+
+// Escribe todas las métricas agregadas en formato texto "nombre valor"
+void write_stats(FILE *out) {
+    static const char *type_keys[METRIC_TYPES] = {
+        "unknown", "discover", "offer", "request", "decline", "ack", "nak", "release", "inform",
+        "forcerenew", "leasequery", "leaseunassigned", "leaseunknown", "leaseactive"
+    };
+    metrics_totals t;
+    metrics_collect(&t);
+
+    fprintf(out, "uptime_seconds %ld\n", (long)(time(NULL) - server_started));
+    fprintf(out, "threads %d\n", atomic_load(&metrics_threads));
+    for (int j = 0; j < METRIC_TYPES; j++) {
+        if (t.rx_type[j] != 0) {
+            fprintf(out, "rx_%s %lu\n", type_keys[j], t.rx_type[j]);
+        }
     }
+    fprintf(out, "tx_offer %lu\ntx_ack %lu\ntx_nak %lu\n", t.tx_type[DHCPOFFER], t.tx_type[DHCPACK], t.tx_type[DHCPNAK]);
+    if (t.rx_type[DHCPLEASEQUERY] != 0) {
+        fprintf(out, "tx_leaseactive %lu\ntx_leaseunassigned %lu\ntx_leaseunknown %lu\n", t.tx_type[DHCPLEASEACTIVE],
+                t.tx_type[DHCPLEASEUNASSIGNED], t.tx_type[DHCPLEASEUNKNOWN]);
+    }
+    fprintf(out, "malformed %lu\ndropped_queue_full %lu\npool_exhausted %lu\nno_scope %lu\nleases_expired %lu\n",
+            t.malformed, t.dropped, t.pool_exhausted, t.no_scope, t.expired);
+    fprintf(out, "shed_high_priority %lu\nshed_low_priority %lu\nevicted_low_priority %lu\nrate_limited %lu\n",
+            t.shed[PRIO_ALTA], t.shed[PRIO_BAJA], t.evicted, t.rate_limited);
+    pool_config *cfg = config_enter();
+    fprintf(out, "config_generation %lu\nscopes %d\n", cfg->generation, cfg->num_scopes);
+    fprintf(out, "pool_size %d\npool_excluded %ld\npool_leased %ld\npool_utilization %.4f\n", cfg->pool_size,
+            cfg->excluded, (long)t.leased, cfg->pool_size ? (double)t.leased / cfg->pool_size : 0.0);
+    fprintf(out, "pool_offered %ld\noffers_expired %lu\nreservations %zu\n", (long)t.offered, t.offers_expired,
+            cfg->reservations.count);
+    config_exit();
+    if (ha.enabled) {
+        fprintf(out, "ha_role %d\nha_peer_up %d\nha_deferred_discover %lu\n", ha.role, ha_peer_up(), t.deferred);
+        fprintf(out, "ha_records_sent %lu\nha_records_applied %lu\nha_retransmits %lu\nha_resyncs %lu\n",
+                atomic_load(&ha.records_sent), atomic_load(&ha.records_applied), atomic_load(&ha.retransmits),
+                atomic_load(&ha.resyncs));
+    }
+    fprintf(out, "rx_packets %lu\nrx_calls %lu\ntx_packets %lu\ntx_calls %lu\n",
+            t.rx_packets, t.rx_calls, t.tx_packets, t.tx_calls);
+    fprintf(out, "latency_count %lu\n", t.latency_count);
+    if (t.latency_count > 0) {
+        fprintf(out, "latency_p50_us %.1f\nlatency_p90_us %.1f\nlatency_p99_us %.1f\nlatency_p999_us %.1f\nlatency_max_us %.1f\n",
+                totals_percentile(&t, 50) / 1000.0, totals_percentile(&t, 90) / 1000.0,
+                totals_percentile(&t, 99) / 1000.0, totals_percentile(&t, 99.9) / 1000.0,
+                t.latency_max_ns / 1000.0);
+    }
+}
 
-    pthread_mutex_lock(&lock);
-    active_threads--;
-    pthread_mutex_unlock(&lock);
+// Hilo del punto de consulta: cada conexión al socket UNIX recibe un informe y se cierra
+void* stats_thread(void* arg) {
+    int listenfd = *(int*) arg;
 
-    free(msg);
-    free(data);
-    pthread_exit(NULL);
+    while (1) {
+        int fd = accept(listenfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                perror("Error en accept() del socket de estadísticas");
+            }
+            continue;
+        }
+        FILE *out = fdopen(fd, "w");
+        if (out == NULL) {
+            close(fd);
+            continue;
+        }
+        write_stats(out);
+        fclose(out);
+    }
+    return NULL;
 }
 
-// Función principal del servidor
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Uso: %s <IP de inicio> <IP de fin>\n", argv[0]);
+// Abre el socket UNIX de estadísticas y arranca su hilo
+void stats_start(const char *path) {
+    static int listenfd;
+    struct sockaddr_un addr;
+    pthread_t thread;
+    sigset_t block, old;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Ruta del socket de estadísticas demasiado larga: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("No se pudo crear el socket de estadísticas");
+        exit(EXIT_FAILURE);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);  // Socket de una ejecución anterior
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenfd, 16) < 0) {
+        perror("No se pudo enlazar el socket de estadísticas");
         exit(EXIT_FAILURE);
     }
 
-    const char *ip_start = argv[1];
-    const char *ip_end = argv[2];
-    init_ip_pool(ip_start, ip_end);
+    // Las señales de fin solo llegan al hilo principal
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if (pthread_create(&thread, NULL, stats_thread, &listenfd) != 0) {
+        perror("Error al crear el hilo de estadísticas");
+        exit(EXIT_FAILURE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_detach(thread);
+    LOG(LOG_INFO, "Estadísticas disponibles en el socket UNIX %s", path);
+}
 
+// Crea el socket UDP del servidor; con reuseport varios sockets comparten el puerto
+int open_server_socket(int reuseport) {
     int sockfd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    fd_set readfds;
+    struct sockaddr_in server_addr;
 
-    if (pthread_mutex_init(&lock, NULL) != 0) {
-        perror("Mutex init failed");
+    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("No se pudo crear el socket");
         exit(EXIT_FAILURE);
     }
 
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("No se pudo crear el socket");
+    int one = 1;
+    // Las respuestas a clientes sin IP se envían por difusión
+    setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+    if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        perror("No se pudo activar SO_REUSEPORT");
+        close(sockfd);
         exit(EXIT_FAILURE);
     }
-    printf("Socket creado correctamente\n");
 
+    memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_addr = listen_addr;
     server_addr.sin_port = htons(PORT);
 
     if (bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
@@ -255,64 +4449,518 @@ int main(int argc, char *argv[]) {
         close(sockfd);
         exit(EXIT_FAILURE);
     }
-    printf("Socket enlazado al puerto %d\n", PORT);
+    return sockfd;
+}
 
-    printf("Servidor DHCP iniciado y escuchando en el puerto %d...\n", PORT);
+// Temporizador de 1 s que hace avanzar la rueda de expiraciones aunque no haya tráfico
+int open_lease_timer(void) {
+    int timerfd;
+    struct itimerspec tick = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
 
-    while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        int activity = select(sockfd + 1, &readfds, NULL, NULL, NULL);
+    if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0 || timerfd_settime(timerfd, 0, &tick, NULL) < 0) {
+        perror("No se pudo crear el temporizador de leases");
+        exit(EXIT_FAILURE);
+    }
+    return timerfd;
+}
+
+// Avanza las ruedas de las particiones propias del hilo cuando vence su temporizador
+static void shard_tick(int timerfd) {
+    uint64_t expirations;
+    if (read(timerfd, &expirations, sizeof(expirations)) <= 0) {
+        return;
+    }
+    pool_config *cfg = config_enter();
+    time_t now = time(NULL);
+    for (int k = 0; k < cfg->num_shards; k++) {
+        if (cfg->shards[k].part == home_shard) {
+            wheel_advance(&cfg->shards[k].timers, now);
+        }
+    }
+    config_exit();
+}
+
+// Bucle de una partición con io_uring. Devuelve -1 (con errno) sin haber atendido
+// ningún paquete si el núcleo no admite el anillo, los búferes registrados o la
+// recepción multishot; el llamante sigue entonces con recvmmsg/sendmmsg
+static int uring_loop(int sockfd, int timerfd) {
+    uring_io u;
+    client_data data;
+    int served = 0;
+
+    if (uring_setup(&u, sockfd) < 0) {
+        return -1;
+    }
+    memset(&data, 0, sizeof(data));
+    data.sockfd = sockfd;
+    tx_uring = &u;
+    uring_arm_recv(&u);
+    uring_arm_timer(&u, timerfd);
 
-        if (activity < 0 && errno != EINTR) {
-            perror("Error en select()");
+    while (running) {
+        if (uring_enter(&u, 1) < 0 && errno != EINTR && errno != EBUSY) {
+            perror("Error en io_uring_enter");
             break;
         }
+        unsigned head = *u.cq_head;
+        unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        uint64_t now = monotonic_ns();
+        thread_metrics *m = metrics();
+        pool_config *cfg = NULL;
+        int recycled = 0, tick = 0;
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+            unsigned tag = cqe->user_data >> 32;
+
+            if (tag == URING_SEND) {
+                int k = (uint32_t)cqe->user_data;
+                if (cqe->res < 0) {
+                    errno = -cqe->res;
+                    perror("Error al enviar respuesta");
+                } else {
+                    record_latency(u.sends[k].rx_ns, now);
+                    metric_add(&m->tx_packets, 1);
+                }
+                u.free_sends[u.num_free++] = k;
+            } else if (tag == URING_TIMER) {
+                tick = 1;
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    uring_arm_timer(&u, timerfd);
+                }
+            } else {
+                if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                    if (!served && cqe->res == -EINVAL) {
+                        // Núcleo sin recepción multishot
+                        tx_uring = NULL;
+                        if (cfg != NULL) {
+                            config_exit();
+                        }
+                        uring_free(&u);
+                        errno = EINVAL;
+                        return -1;
+                    }
+                    errno = -cqe->res;
+                    perror("Error en la recepción de io_uring");
+                }
+                if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    uint8_t *buf = u.buffers + (size_t)bid * URING_BUF_SIZE;
+                    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+                    const uint8_t *payload = buf + sizeof(*out) + u.recv_hdr.msg_namelen;
+
+                    if (!(out->flags & MSG_TRUNC) && out->payloadlen <= sizeof(dhcp_packet)) {
+                        memcpy(&data.client_addr, buf + sizeof(*out), sizeof(data.client_addr));
+                        memcpy(&data.msg, payload, out->payloadlen);
+                        data.len = out->payloadlen;
+                        data.rx_ns = now;
+                        metric_add(&m->rx_packets, 1);
+                        if (cfg == NULL) {
+                            cfg = config_enter();
+                        }
+                        if (rate_allow(&data)) {
+                            handle_client(cfg, &data);
+                        }
+                        served = 1;
+                    }
+                    uring_buf_push(&u, bid);
+                    recycled = 1;
+                }
+                // Sin más búferes o tras un error el núcleo termina la recepción: se rearma
+                if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                    uring_arm_recv(&u);
+                }
+            }
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+        if (cfg != NULL) {
+            config_exit();
+        }
+        if (recycled) {
+            uring_buf_publish(&u);
+        }
+        if (tick) {
+            shard_tick(timerfd);
+        }
+    }
+
+    tx_uring = NULL;
+    uring_free(&u);
+    return 0;
+}
+
+// Hilo de una partición en modo fragmentado: socket SO_REUSEPORT propio, fijado a
+// una CPU, atiende sus paquetes en línea y expira los leases de su partición
+typedef struct {
+    int id;
+    int sockfd;
+    pthread_t thread;
+} shard_worker;
+
+void* shard_thread(void* arg) {
+    shard_worker *worker = (shard_worker*) arg;
+    int sockfd = worker->sockfd;
+    int timerfd = open_lease_timer();
+    int max = io_mode == IO_CLASSIC ? 1 : batch_size;
+    fd_set readfds;
+
+    home_shard = worker->id;
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->id % (ncpus > 0 ? ncpus : 1), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    if (io_mode == IO_URING) {
+        if (uring_loop(sockfd, timerfd) == 0) {
+            close(timerfd);
+            return NULL;
+        }
+        LOG(LOG_WARN, "io_uring no disponible en la partición %d (%s): se usa recvmmsg/sendmmsg", worker->id, strerror(errno));
+    }
+
+    client_data *msgs = calloc(max, sizeof(client_data));
+    struct mmsghdr *hdrs = calloc(max, sizeof(struct mmsghdr));
+    struct iovec *iov = calloc(max, sizeof(struct iovec));
+    if (msgs == NULL || hdrs == NULL || iov == NULL) {
+        perror("Error al asignar memoria para la partición");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < max; i++) {
+        msgs[i].sockfd = sockfd;
+        iov[i].iov_base = &msgs[i].msg;
+        iov[i].iov_len = sizeof(dhcp_packet);
+        hdrs[i].msg_hdr.msg_name = &msgs[i].client_addr;
+        hdrs[i].msg_hdr.msg_iov = &iov[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+    if (io_mode != IO_CLASSIC) {
+        tx_batch = reply_batch_create();
+    }
+
+    while (running) {
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        FD_SET(timerfd, &readfds);
+        if (select((sockfd > timerfd ? sockfd : timerfd) + 1, &readfds, NULL, NULL, NULL) < 0) {
+            if (errno != EINTR) {
+                perror("Error en select()");
+                break;
+            }
+            continue;
+        }
 
-        check_ip_leases();
+        if (FD_ISSET(timerfd, &readfds)) {
+            shard_tick(timerfd);
+        }
 
         if (FD_ISSET(sockfd, &readfds)) {
-            pthread_t thread;
-            client_data *data = malloc(sizeof(client_data));
-
-            data->msg = malloc(sizeof(dhcp_message));
-            if (recvfrom(sockfd, data->msg, sizeof(dhcp_message), 0, (struct sockaddr*)&client_addr, &addr_len) < 0) {
-                perror("Error al recibir mensaje");
-                free(data->msg);
-                free(data);
+            for (int i = 0; i < max; i++) {
+                hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            }
+            int got = recvmmsg(sockfd, hdrs, max, MSG_DONTWAIT, NULL);
+            uint64_t rx_ns = monotonic_ns();
+            metric_add(&metrics()->rx_calls, 1);
+            if (got <= 0) {
                 continue;
             }
+            metric_add(&metrics()->rx_packets, got);
+            pool_config *cfg = config_enter();
+            for (int i = 0; i < got; i++) {
+                msgs[i].len = hdrs[i].msg_len;
+                msgs[i].rx_ns = rx_ns;
+                if (rate_allow(&msgs[i])) {
+                    handle_client(cfg, &msgs[i]);
+                }
+            }
+            config_exit();
+            if (tx_batch != NULL && tx_batch->count > 0) {
+                flush_replies(tx_batch);
+            }
+        }
+    }
+
+    close(timerfd);
+    free(msgs);
+    free(hdrs);
+    free(iov);
+    free(tx_batch);
+    return NULL;
+}
 
-            data->sockfd = sockfd;
-            data->client_addr = client_addr;
+// Arranca el modo fragmentado y espera una señal de fin
+void run_sharded(int num_threads) {
+    shard_worker *workers = calloc(num_threads, sizeof(shard_worker));
+    sigset_t block, old;
 
-            pthread_mutex_lock(&lock);
-            if (active_threads < MAX_THREADS) {
-                active_threads++;
-                pthread_mutex_unlock(&lock);
+    if (workers == NULL) {
+        perror("Error al asignar memoria para los hilos de partición");
+        exit(EXIT_FAILURE);
+    }
+
+    // Las señales de fin y de recarga solo llegan al hilo principal
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (int i = 0; i < num_threads; i++) {
+        workers[i].id = i;
+        workers[i].sockfd = open_server_socket(1);
+        if (pthread_create(&workers[i].thread, NULL, shard_thread, &workers[i]) != 0) {
+            perror("Error al crear el hilo de partición");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    pool_config *cfg = atomic_load(&active_config);
+    LOG(LOG_INFO, "Servidor DHCP iniciado en modo fragmentado: %d sockets SO_REUSEPORT en el puerto %d, %d particiones en %d ámbitos",
+        num_threads, PORT, cfg->num_shards, cfg->num_scopes);
+
+    while (running) {
+        pause();
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config();
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].sockfd);
+    }
+    free(workers);
+}
+
+// Muestra las opciones de la línea de órdenes y termina
+void usage(const char *prog) {
+    fprintf(stderr, "Uso: %s [-w hilos] [-q tamaño de cola] [-m clasico|lotes|uring] [-b tamaño de lote] [-s particiones] [-j prefijo del diario | -j -] [-e socket de estadísticas | -e -] [-v error|aviso|info|depuracion] [-i IP del servidor] [-S fichero de configuración] [-r fichero de reservas] [-l mensajes/s por MAC[:ráfaga] | -l 0] [-o segundos de reserva de una oferta] [-a IP de escucha] [-P IP del otro servidor del par[:puerto] -H 0|1] [<IP de inicio> <IP de fin>]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// Función principal del servidor
+int main(int argc, char *argv[]) {
+    int num_workers = DEFAULT_WORKERS;
+    long queue_size = DEFAULT_QUEUE;
+    int shard_threads = 0;
+    const char *journal_prefix = DEFAULT_JOURNAL;
+    const char *server_ip = SERVER_IDENTIFIER;
+    const char *stats_path = DEFAULT_STATS;
+    int ha_role = -1;
+    int opt;
 
-                if (pthread_create(&thread, NULL, handle_client, (void*)data) != 0) {
-                    perror("Error al crear el hilo");
-                    pthread_mutex_lock(&lock);
-                    active_threads--;
-                    pthread_mutex_unlock(&lock);
-                    free(data->msg);
-                    free(data);
+    while ((opt = getopt(argc, argv, "w:q:m:b:s:j:e:v:i:S:r:l:o:a:P:H:")) != -1) {
+        switch (opt) {
+            case 'w':
+                num_workers = atoi(optarg);
+                break;
+            case 'q':
+                queue_size = atol(optarg);
+                break;
+            case 'm':
+                if (strcmp(optarg, "clasico") == 0) {
+                    io_mode = IO_CLASSIC;
+                } else if (strcmp(optarg, "lotes") == 0) {
+                    io_mode = IO_BATCH;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    io_mode = IO_URING;
                 } else {
-                    pthread_detach(thread); // No esperar a que el hilo termine
+                    usage(argv[0]);
+                }
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 's':
+                shard_threads = atoi(optarg);
+                if (shard_threads < 1) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'j':
+                journal_prefix = strcmp(optarg, "-") == 0 ? NULL : optarg;
+                break;
+            case 'e':
+                stats_path = strcmp(optarg, "-") == 0 ? NULL : optarg;
+                break;
+            case 'v': {
+                static const char *levels[] = {"error", "aviso", "info", "depuracion"};
+                log_level = -1;
+                for (int l = LOG_ERROR; l <= LOG_DEBUG; l++) {
+                    if (strcmp(optarg, levels[l]) == 0) {
+                        log_level = l;
+                    }
+                }
+                if (log_level < 0) {
+                    usage(argv[0]);
+                }
+                break;
+            }
+            case 'i':
+                server_ip = optarg;
+                break;
+            case 'S':
+                config_path = optarg;
+                break;
+            case 'r':
+                reservations_path = optarg;
+                break;
+            case 'o':
+                offer_time = atoi(optarg);
+                if (offer_time < 1) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'l':
+                if (sscanf(optarg, "%u:%u", &rate_per_sec, &rate_burst) < 1 || rate_burst < 1 || rate_burst > 65535) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &listen_addr) != 1) {
+                    usage(argv[0]);
                 }
+                break;
+            case 'P': {
+                char host[INET_ADDRSTRLEN];
+                int port = REPLICA_PORT;
+                if (sscanf(optarg, "%15[^:]:%d", host, &port) < 1 || port < 1 || port > 65535 ||
+                    inet_pton(AF_INET, host, &ha.peer.sin_addr) != 1) {
+                    usage(argv[0]);
+                }
+                ha.peer.sin_family = AF_INET;
+                ha.peer.sin_port = htons(port);
+                ha.enabled = 1;
+                break;
+            }
+            case 'H':
+                ha_role = atoi(optarg);
+                if (strcmp(optarg, "0") != 0 && strcmp(optarg, "1") != 0) {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    int positional = argc - optind;
+    if ((positional != 2 && !(positional == 0 && config_path != NULL)) || num_workers < 1 || queue_size < 1 ||
+        batch_size < 1 || batch_size > MAX_BATCH || ha.enabled != (ha_role >= 0)) {
+        usage(argv[0]);
+    }
+    ha.role = ha_role;
+
+    // io_uring atiende cada paquete en el hilo que lo recibe: usa el modo fragmentado
+    if (io_mode == IO_URING && shard_threads == 0) {
+        shard_threads = 1;
+    }
+    if (shard_threads > 0) {
+        num_parts = shard_threads;
+    }
+    // El identificador va en las opciones de cada ámbito: se resuelve antes de compilarlas
+    if (inet_pton(AF_INET, server_ip, &server_id) != 1) {
+        usage(argv[0]);
+    }
+    if (positional == 2) {
+        config_range[0] = argv[optind];
+        config_range[1] = argv[optind + 1];
+    }
+    pool_config *cfg = build_config(config_path, config_range[0], config_range[1], reservations_path);
+    if (cfg == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    atomic_store(&active_config, cfg);
+    server_started = time(NULL);
+    log_start();
+    if (journal_prefix != NULL) {
+        journal_start(journal_prefix);
+    }
+    if (stats_path != NULL) {
+        stats_start(stats_path);
+    }
+    rate_init();
+    if (ha.enabled) {
+        replica_start();
+    }
+
+    int sockfd;
+    fd_set readfds;
+    int timerfd;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    if (shard_threads > 0) {
+        run_sharded(shard_threads);
+        replica_stop();
+        journal_stop();
+        log_stop();
+        print_io_stats();
+        if (stats_path != NULL) {
+            unlink(stats_path);
+        }
+        free_config(atomic_load(&active_config));
+        return 0;
+    }
+
+    sockfd = open_server_socket(0);
+    LOG(LOG_INFO, "Socket enlazado al puerto %d", PORT);
+    timerfd = open_lease_timer();
+
+    init_workers(num_workers, queue_size);
+
+    LOG(LOG_INFO, "Servidor DHCP iniciado y escuchando en el puerto %d (E/S %s)...", PORT, io_mode == IO_BATCH ? "por lotes" : "clásica");
+
+    while (running) {
+        FD_ZERO(&readfds);
+        FD_SET(sockfd, &readfds);
+        FD_SET(timerfd, &readfds);
+        int activity = select((sockfd > timerfd ? sockfd : timerfd) + 1, &readfds, NULL, NULL, NULL);
+
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config();
+        }
+
+        if (activity < 0) {
+            if (errno != EINTR) {
+                perror("Error en select()");
+                break;
+            }
+            continue;
+        }
+
+        if (FD_ISSET(timerfd, &readfds)) {
+            uint64_t expirations;
+            if (read(timerfd, &expirations, sizeof(expirations)) > 0) {
+                check_ip_leases();
+            }
+        }
+
+        if (FD_ISSET(sockfd, &readfds)) {
+            if (io_mode == IO_BATCH) {
+                receive_batch(sockfd);
             } else {
-                pthread_mutex_unlock(&lock);
-                printf("Máximo número de hilos alcanzado, esperando...\n");
-                free(data->msg);
-                free(data);
-                sleep(1);
+                receive_one(sockfd);
             }
         }
     }
 
+    replica_stop();
+    journal_stop();
+    log_stop();
+    print_io_stats();
+    if (stats_path != NULL) {
+        unlink(stats_path);
+    }
+    close(timerfd);
     close(sockfd);
-    pthread_mutex_destroy(&lock);
-    free(ip_pool);
+    free_config(atomic_load(&active_config));
     return 0;
 }